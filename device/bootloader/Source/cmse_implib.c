@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <arm_cmse.h>
 #include <nrf.h>
 
 #include "battery.h"
@@ -11,6 +12,7 @@
 #include "ipc.h"
 #include "localization.h"
 #include "mari.h"
+#include "ota.h"
 #include "rng.h"
 #include "lh2.h"
 #include "saadc.h"
@@ -27,24 +29,100 @@ __attribute__((cmse_nonsecure_entry)) void swarmit_keep_alive(void) {
     }
 }
 
-__attribute__((cmse_nonsecure_entry)) void swarmit_send_data_packet(const uint8_t *packet, uint8_t length) {
+__attribute__((cmse_nonsecure_entry)) uint8_t swarmit_send_data_packet(const uint8_t *packet, uint8_t length) {
+    if (length > UINT8_MAX - 2) {
+        return 0;
+    }
+    if (cmse_check_address_range((void *)packet, length, CMSE_NONSECURE | CMSE_MPU_READ) == NULL) {
+        // Ensure the packet is readable by the caller
+        return 0;
+    }
     size_t pos = 0;
     _tx_data_buffer[pos++] = PACKET_DATA;
     _tx_data_buffer[pos++] = length;
-    memcpy(_tx_data_buffer + pos, &packet, length);
+    memcpy(_tx_data_buffer + pos, packet, length);
     pos += length;
-    mari_node_tx(_tx_data_buffer, pos);
+    return mari_node_tx(_tx_data_buffer, pos);
+}
+
+__attribute__((cmse_nonsecure_entry)) uint8_t swarmit_send_raw_data(const uint8_t *packet, uint8_t length) {
+    if (cmse_check_address_range((void *)packet, length, CMSE_NONSECURE | CMSE_MPU_READ) == NULL) {
+        // Ensure the packet is readable by the caller
+        return 0;
+    }
+    return mari_node_tx(packet, length);
 }
 
-__attribute__((cmse_nonsecure_entry)) void swarmit_send_raw_data(const uint8_t *packet, uint8_t length) {
-    mari_node_tx(packet, length);
+__attribute__((cmse_nonsecure_entry)) uint8_t swarmit_tx_pending(void) {
+    return mari_node_tx_pending();
 }
 
 __attribute__((cmse_nonsecure_entry)) void swarmit_ipc_isr(ipc_isr_cb_t cb) {
     if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_RADIO_RX]) {
         NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_RADIO_RX] = 0;
-        cb((const uint8_t *)ipc_shared_data.rx_pdu.buffer, ipc_shared_data.rx_pdu.length);
+        // Deliver all the PDUs queued since the last event, a slot is released once its callback returned
+        uint8_t tail = ipc_shared_data.rx_ring.tail;
+        while (tail != ipc_shared_data.rx_ring.head) {
+            // Read the slot content after the head
+            __DMB();
+            volatile ipc_radio_pdu_t *pdu = &ipc_shared_data.rx_ring.pdus[tail & (IPC_RADIO_PDU_SLOTS - 1)];
+            cb((const uint8_t *)pdu->buffer, pdu->length);
+            __DMB();
+            ipc_shared_data.rx_ring.tail = ++tail;
+        }
+    }
+
+    // Images received while the user image runs are written to the staging slot from a lower priority interrupt
+    if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_START]) {
+        NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_START] = 0;
+        ota_request(OTA_REQUEST_START);
+    }
+
+    if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_CHUNK]) {
+        NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_CHUNK] = 0;
+        ota_request(OTA_REQUEST_CHUNKS);
+    }
+
+    if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_STATUS]) {
+        NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_STATUS] = 0;
+        ota_request(OTA_REQUEST_BITMAP);
+    }
+
+    if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_PAGE_HASHES]) {
+        NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_PAGE_HASHES] = 0;
+        ota_request(OTA_REQUEST_PAGE_HASHES);
+    }
+
+    if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_LOCK_RELEASE]) {
+        // Only wakes up ipc_lock
+        NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_LOCK_RELEASE] = 0;
+    }
+}
+
+__attribute__((cmse_nonsecure_entry)) void swarmit_rx_filter(const uint8_t *types, size_t count) {
+    if (count && cmse_check_address_range((void *)types, count, CMSE_NONSECURE | CMSE_MPU_READ) == NULL) {
+        // Ensure the types are readable by the caller
+        return;
+    }
+
+    // The network core keeps delivering all packets while the bitmap is updated
+    ipc_shared_data.rx_filter.enabled = false;
+    __DMB();
+    memset((void *)ipc_shared_data.rx_filter.types, 0, sizeof(ipc_shared_data.rx_filter.types));
+    for (size_t i = 0; i < count; i++) {
+        ipc_shared_data.rx_filter.types[types[i] >> 3] |= (1 << (types[i] & 0x07));
     }
+    __DMB();
+    ipc_shared_data.rx_filter.enabled = (count > 0);
+}
+
+__attribute__((cmse_nonsecure_entry)) void swarmit_rx_coalesce(uint8_t batch_size, uint32_t batch_delay_us) {
+    // Packets are dropped once the ring is full, don't wait for more
+    if (batch_size > IPC_RADIO_PDU_SLOTS) {
+        batch_size = IPC_RADIO_PDU_SLOTS;
+    }
+    ipc_shared_data.rx_filter.batch_delay_us = batch_delay_us;
+    ipc_shared_data.rx_filter.batch_size = batch_size;
 }
 
 __attribute__((cmse_nonsecure_entry)) void swarmit_init_rng(void) {
@@ -52,7 +130,18 @@ __attribute__((cmse_nonsecure_entry)) void swarmit_init_rng(void) {
 }
 
 __attribute__((cmse_nonsecure_entry)) void swarmit_read_rng(uint8_t *value) {
-    rng_read(value);
+    // Only wait for the network core when the pool is empty
+    if (rng_read_pool(value, 1) == 0) {
+        rng_read(value);
+    }
+}
+
+__attribute__((cmse_nonsecure_entry)) size_t swarmit_read_rng_bytes(uint8_t *data, size_t length) {
+    if (cmse_check_address_range(data, length, CMSE_NONSECURE | CMSE_MPU_READWRITE) == NULL) {
+        // Ensure the output buffer is writable by the caller
+        return 0;
+    }
+    return rng_read_pool(data, length);
 }
 
 __attribute__((cmse_nonsecure_entry)) uint64_t swarmit_read_device_id(void) {
@@ -70,11 +159,62 @@ __attribute__((cmse_nonsecure_entry)) void swarmit_log_data(uint8_t *data, size_
         return;
     }
 
-    ipc_shared_data.log.length = length;
-    memcpy((void *)ipc_shared_data.log.data, data, length);
+    // Entries are also logged from interrupts, claim the space atomically
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint16_t head = ipc_shared_data.log.head;
+    size_t available = IPC_LOG_RING_SIZE - (uint16_t)(head - ipc_shared_data.log.tail);
+    if (available < length + 1) {
+        ipc_shared_data.log.dropped++;
+        __set_PRIMASK(primask);
+        return;
+    }
+    ipc_shared_data.log.data[head++ & (IPC_LOG_RING_SIZE - 1)] = length;
+    for (size_t i = 0; i < length; i++) {
+        ipc_shared_data.log.data[head++ & (IPC_LOG_RING_SIZE - 1)] = data[i];
+    }
+    // Publish the entry before the new head
+    __DMB();
+    ipc_shared_data.log.head = head;
+    __set_PRIMASK(primask);
+
     NRF_IPC_S->TASKS_SEND[IPC_CHAN_LOG_EVENT] = 1;
 }
 
+__attribute__((cmse_nonsecure_entry)) bool swarmit_log_record(const char *fmt, const uint32_t *args, size_t count) {
+    if (count > IPC_LOG_RECORD_ARGS_MAX) {
+        return false;
+    }
+
+    if (count && cmse_check_address_range((void *)args, count * sizeof(uint32_t), CMSE_NONSECURE | CMSE_MPU_READ) == NULL) {
+        // Ensure the arguments are readable by the caller
+        return false;
+    }
+
+    // The format string is never read, only its address is sent
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint8_t head = ipc_shared_data.log_records.head;
+    if ((uint8_t)(head - ipc_shared_data.log_records.tail) >= IPC_LOG_RECORD_SLOTS) {
+        ipc_shared_data.log_records.dropped++;
+        __set_PRIMASK(primask);
+        return false;
+    }
+    volatile ipc_log_record_t *record = &ipc_shared_data.log_records.records[head & (IPC_LOG_RECORD_SLOTS - 1)];
+    record->fmt = (uint32_t)fmt;
+    record->count = count;
+    for (size_t i = 0; i < count; i++) {
+        record->args[i] = args[i];
+    }
+    // Publish the record before the new head
+    __DMB();
+    ipc_shared_data.log_records.head = head + 1;
+    __set_PRIMASK(primask);
+
+    NRF_IPC_S->TASKS_SEND[IPC_CHAN_LOG_RECORD] = 1;
+    return true;
+}
+
 __attribute__((cmse_nonsecure_entry)) void swarmit_localization_process_data(void) {
     localization_process_data();
 }
@@ -13,6 +13,7 @@
  * @}
  */
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -21,13 +22,25 @@
 typedef void (*ipc_isr_cb_t)(const uint8_t *, size_t) __attribute__((cmse_nonsecure_call));
 
 __attribute__((cmse_nonsecure_entry, aligned)) void swarmit_keep_alive(void);
-__attribute__((cmse_nonsecure_entry, aligned)) void swarmit_send_data_packet(const uint8_t *packet, uint8_t length);
-__attribute__((cmse_nonsecure_entry, aligned)) void swarmit_send_raw_data(const uint8_t *packet, uint8_t length);
+// Packets are queued, these functions return the number of packets waiting to be sent or 0 when the packet is dropped
+__attribute__((cmse_nonsecure_entry, aligned)) uint8_t swarmit_send_data_packet(const uint8_t *packet, uint8_t length);
+__attribute__((cmse_nonsecure_entry, aligned)) uint8_t swarmit_send_raw_data(const uint8_t *packet, uint8_t length);
+__attribute__((cmse_nonsecure_entry, aligned)) uint8_t swarmit_tx_pending(void);
+// The callback gets a pointer to the received packet in shared RAM, only valid until it returns
 __attribute__((cmse_nonsecure_entry, aligned)) void swarmit_ipc_isr(ipc_isr_cb_t cb);
+// Only deliver the packets whose first byte is one of types, all packets when count is 0
+__attribute__((cmse_nonsecure_entry, aligned)) void swarmit_rx_filter(const uint8_t *types, size_t count);
+// Raise the RX interrupt once batch_size packets are queued, or batch_delay_us after a packet is queued
+__attribute__((cmse_nonsecure_entry, aligned)) void swarmit_rx_coalesce(uint8_t batch_size, uint32_t batch_delay_us);
 __attribute__((cmse_nonsecure_entry, aligned)) void swarmit_init_rng(void);
 __attribute__((cmse_nonsecure_entry, aligned)) void swarmit_read_rng(uint8_t *value);
+// Fill data with bytes of the entropy pool without blocking, returns the number of bytes written
+__attribute__((cmse_nonsecure_entry, aligned)) size_t swarmit_read_rng_bytes(uint8_t *data, size_t length);
 __attribute__((cmse_nonsecure_entry, aligned)) uint64_t swarmit_read_device_id(void);
 __attribute__((cmse_nonsecure_entry, aligned)) void swarmit_log_data(uint8_t *data, size_t length);
+// Queue a log record made of the address of fmt and of count 32-bit arguments, formatted by the controller from the
+// user image ELF file, returns false when the record is dropped
+__attribute__((cmse_nonsecure_entry, aligned)) bool swarmit_log_record(const char *fmt, const uint32_t *args, size_t count);
 
 // Lighthouse 2 functions exposed to user image
 __attribute__((cmse_nonsecure_entry, aligned)) void swarmit_localization_process_data(void);
@@ -0,0 +1,133 @@
+/**
+ * @file
+ * @ingroup bootloader_delta
+ *
+ * @brief  Implementation of the in place delta patching.
+ *
+ * @author Anonymous Author <anon@anonymous.com>
+ *
+ * @copyright Anonymized Copyright, 2025
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delta.h"
+#include "nvmc.h"
+
+//=========================== defines ==========================================
+
+#define DELTA_PAGE_MASK         (FLASH_PAGE_SIZE - 1)
+
+//=========================== private ==========================================
+
+static inline uint32_t _read_uint32(const uint8_t *data) {
+    return data[0] | (data[1] << 8) | (data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static void _write_page(delta_patcher_t *patcher, uint32_t offset, size_t length) {
+    const uint8_t *addr = (const uint8_t *)(patcher->image_addr + offset);
+
+    // Keep the flash content after the end of the image so it doesn't force an erase
+    memcpy(&patcher->page[length], &addr[length], FLASH_PAGE_SIZE - length);
+    // Unchanged words are left untouched
+    nvmc_page_update((uint32_t)addr / FLASH_PAGE_SIZE, patcher->page);
+}
+
+static inline void _output(delta_patcher_t *patcher, uint8_t byte) {
+    patcher->page[patcher->position & DELTA_PAGE_MASK] = byte;
+    patcher->position++;
+    if ((patcher->position & DELTA_PAGE_MASK) == 0) {
+        _write_page(patcher, patcher->position - FLASH_PAGE_SIZE, FLASH_PAGE_SIZE);
+    }
+}
+
+static inline bool _read_source(delta_patcher_t *patcher, uint8_t *byte) {
+    // Pages before the one being built are already overwritten when patching in place
+    if (patcher->image_addr == patcher->base_addr && patcher->source < (patcher->position & ~DELTA_PAGE_MASK)) {
+        return false;
+    }
+    *byte = *(const uint8_t *)(patcher->base_addr + patcher->source++);
+    return true;
+}
+
+static bool _read_header(delta_patcher_t *patcher) {
+    patcher->op = patcher->header[0];
+    patcher->remaining = _read_uint32(&patcher->header[1]);
+    if (patcher->remaining > patcher->image_size - patcher->position) {
+        return false;
+    }
+    if (patcher->op == DELTA_OP_INSERT) {
+        return true;
+    }
+    patcher->source = _read_uint32(&patcher->header[5]);
+    return patcher->source <= patcher->source_size && patcher->remaining <= patcher->source_size - patcher->source;
+}
+
+//=========================== public ===========================================
+
+void delta_init(delta_patcher_t *patcher, uint32_t base_addr, uint32_t image_addr, uint32_t source_size, uint32_t image_size) {
+    patcher->base_addr = base_addr;
+    patcher->image_addr = image_addr;
+    patcher->source_size = source_size;
+    patcher->image_size = image_size;
+    patcher->position = 0;
+    patcher->header_length = 0;
+    patcher->remaining = 0;
+}
+
+bool delta_apply(delta_patcher_t *patcher, const uint8_t *input, size_t length) {
+    size_t index = 0;
+    uint8_t byte;
+
+    while (index < length || (patcher->remaining && patcher->op == DELTA_OP_COPY)) {
+        if (patcher->remaining == 0) {
+            // Headers may be split between two calls
+            patcher->header[patcher->header_length++] = input[index++];
+            if (patcher->header[0] > DELTA_OP_INSERT) {
+                return false;
+            }
+            size_t header_size = (patcher->header[0] == DELTA_OP_INSERT) ? 5 : DELTA_HEADER_MAX_SIZE;
+            if (patcher->header_length < header_size) {
+                continue;
+            }
+            patcher->header_length = 0;
+            if (!_read_header(patcher)) {
+                return false;
+            }
+            continue;
+        }
+
+        switch (patcher->op) {
+            case DELTA_OP_COPY:
+                if (!_read_source(patcher, &byte)) {
+                    return false;
+                }
+                _output(patcher, byte);
+                break;
+            case DELTA_OP_ADD:
+                if (!_read_source(patcher, &byte)) {
+                    return false;
+                }
+                _output(patcher, byte + input[index++]);
+                break;
+            case DELTA_OP_INSERT:
+                _output(patcher, input[index++]);
+                break;
+        }
+        patcher->remaining--;
+    }
+
+    return true;
+}
+
+bool delta_finish(delta_patcher_t *patcher) {
+    if (patcher->position != patcher->image_size || patcher->remaining || patcher->header_length) {
+        return false;
+    }
+    if (patcher->position & DELTA_PAGE_MASK) {
+        _write_page(patcher, patcher->position & ~DELTA_PAGE_MASK, patcher->position & DELTA_PAGE_MASK);
+    }
+    return true;
+}
@@ -0,0 +1,90 @@
+#ifndef __DELTA_H
+#define __DELTA_H
+
+/**
+ * @defgroup    bootloader_delta    Delta patching
+ * @ingroup     bootloader
+ * @brief       Apply a delta patch to the installed user image
+ *
+ * A patch is a stream of operations producing the new image in order:
+ * - COPY (type, length, source): copy length bytes of the installed image
+ * - ADD (type, length, source, diffs): add the length diff bytes to the installed image bytes
+ * - INSERT (type, length, bytes): insert length new bytes
+ *
+ * Lengths and sources are 32-bit little endian. The new image is built one
+ * flash page at a time in RAM, the page is only erased and written once
+ * complete and if it differs from flash. When the new image is written in
+ * place, sources must therefore not be located before the page currently
+ * being built.
+ *
+ * @{
+ * @file
+ * @author Anonymous Author <anon@anonymous.com>
+ * @copyright Anonymized Copyright, 2025
+ * @}
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "nvmc.h"
+
+//=========================== defines ==========================================
+
+#define DELTA_HEADER_MAX_SIZE   (9U)    ///< Type, length and source
+
+typedef enum {
+    DELTA_OP_COPY   = 0,
+    DELTA_OP_ADD    = 1,
+    DELTA_OP_INSERT = 2,
+} delta_op_t;
+
+typedef struct {
+    uint8_t     page[FLASH_PAGE_SIZE] __attribute__((aligned(4)));  ///< Image page being built
+    uint32_t    base_addr;                          ///< Address of the installed image in flash
+    uint32_t    image_addr;                         ///< Address where the patched image is written
+    uint32_t    source_size;                        ///< Size of the installed image
+    uint32_t    image_size;                         ///< Size of the patched image
+    uint32_t    position;                           ///< Number of patched bytes produced
+    uint8_t     header[DELTA_HEADER_MAX_SIZE];      ///< Header of the next operation
+    uint8_t     header_length;                      ///< Number of header bytes received
+    delta_op_t  op;                                 ///< Current operation
+    uint32_t    remaining;                          ///< Number of bytes left to produce in the current operation
+    uint32_t    source;                             ///< Current offset in the installed image
+} delta_patcher_t;
+
+//=========================== prototypes =======================================
+
+/**
+ * @brief Prepare a patch of the image installed at base_addr
+ *
+ * @param[in] patcher       pointer to the patcher
+ * @param[in] base_addr     address of the installed image
+ * @param[in] image_addr    address where the new image is written, base_addr to patch in place
+ * @param[in] source_size   size of the installed image
+ * @param[in] image_size    size of the new image
+ */
+void delta_init(delta_patcher_t *patcher, uint32_t base_addr, uint32_t image_addr, uint32_t source_size, uint32_t image_size);
+
+/**
+ * @brief Apply the next bytes of the patch, operations can span several calls
+ *
+ * @param[in] patcher   pointer to the patcher
+ * @param[in] input     patch bytes
+ * @param[in] length    number of patch bytes
+ *
+ * @return true on success, false if the patch is malformed
+ */
+bool delta_apply(delta_patcher_t *patcher, const uint8_t *input, size_t length);
+
+/**
+ * @brief Write the last page of the new image
+ *
+ * @param[in] patcher   pointer to the patcher
+ *
+ * @return true if the whole image was produced
+ */
+bool delta_finish(delta_patcher_t *patcher);
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @file
+ * @ingroup bootloader_fountain
+ *
+ * @brief  Implementation of the fountain decoder.
+ *
+ * @author Anonymous Author <anon@anonymous.com>
+ *
+ * @copyright Anonymized Copyright, 2025
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "fountain.h"
+
+//=========================== private ==========================================
+
+static void _xor(uint8_t *output, const uint8_t *input, size_t length) {
+    uint32_t *output_words = (uint32_t *)output;
+    const uint32_t *input_words = (const uint32_t *)input;
+    for (size_t i = 0; i < (length >> 2); i++) {
+        output_words[i] ^= input_words[i];
+    }
+}
+
+//=========================== public ===========================================
+
+void fountain_init(fountain_decoder_t *decoder, uint32_t generation, uint8_t chunk_count, size_t symbol_size) {
+    decoder->pivots = 0;
+    decoder->generation = generation;
+    decoder->chunk_count = chunk_count;
+    decoder->rank = 0;
+    decoder->symbol_size = symbol_size;
+}
+
+bool fountain_add(fountain_decoder_t *decoder, uint16_t coefficients, const uint8_t *symbol) {
+    // Symbols can only combine chunks of the generation
+    if (decoder->chunk_count < FOUNTAIN_GENERATION_SIZE && (coefficients >> decoder->chunk_count)) {
+        return false;
+    }
+
+    // Reduce the symbol with the rows already present, this clears all its pivot bits
+    uint16_t reduced = coefficients;
+    for (uint8_t pivot = 0; pivot < FOUNTAIN_GENERATION_SIZE; pivot++) {
+        if ((reduced & (1 << pivot)) && (decoder->pivots & (1 << pivot))) {
+            reduced ^= decoder->coefficients[pivot];
+        }
+    }
+    if (reduced == 0) {
+        // Linear combination of symbols already received
+        return false;
+    }
+
+    // Only reduce the symbol bytes once it is known to be useful
+    uint8_t new_pivot = __builtin_ctz(reduced);
+    uint8_t *row = decoder->symbols[new_pivot];
+    memcpy(row, symbol, decoder->symbol_size);
+    reduced = coefficients;
+    for (uint8_t pivot = 0; pivot < FOUNTAIN_GENERATION_SIZE; pivot++) {
+        if ((reduced & (1 << pivot)) && (decoder->pivots & (1 << pivot))) {
+            reduced ^= decoder->coefficients[pivot];
+            _xor(row, decoder->symbols[pivot], decoder->symbol_size);
+        }
+    }
+
+    // Clear the new pivot bit from the other rows to keep them reduced
+    for (uint8_t pivot = 0; pivot < FOUNTAIN_GENERATION_SIZE; pivot++) {
+        if ((decoder->pivots & (1 << pivot)) && (decoder->coefficients[pivot] & (1 << new_pivot))) {
+            decoder->coefficients[pivot] ^= reduced;
+            _xor(decoder->symbols[pivot], row, decoder->symbol_size);
+        }
+    }
+
+    decoder->coefficients[new_pivot] = reduced;
+    decoder->pivots |= (1 << new_pivot);
+    decoder->rank++;
+    return true;
+}
+
+bool fountain_complete(const fountain_decoder_t *decoder) {
+    return decoder->rank == decoder->chunk_count;
+}
+
+const uint8_t *fountain_chunk(const fountain_decoder_t *decoder, uint8_t index) {
+    return decoder->symbols[index];
+}
@@ -0,0 +1,87 @@
+#ifndef __FOUNTAIN_H
+#define __FOUNTAIN_H
+
+/**
+ * @defgroup    bootloader_fountain Fountain decoding
+ * @ingroup     bootloader
+ * @brief       Decode the rateless coded symbols of a broadcast OTA image
+ *
+ * Image chunks are grouped in generations of FOUNTAIN_GENERATION_SIZE
+ * chunks. Each symbol is the XOR of the chunks of a generation selected by a
+ * bit mask of coefficients (GF(2) random linear code). A generation is
+ * decoded as soon as as many linearly independent symbols as chunks are
+ * received, whichever symbols were lost.
+ *
+ * Received symbols are eliminated on the fly (Gauss-Jordan), row i of the
+ * decoder has its pivot at bit i and no other pivot bit set, so once the
+ * rank is complete row i is chunk i of the generation.
+ *
+ * @{
+ * @file
+ * @author Anonymous Author <anon@anonymous.com>
+ * @copyright Anonymized Copyright, 2025
+ * @}
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+//=========================== defines ==========================================
+
+#define FOUNTAIN_GENERATION_SIZE    (16U)   ///< Max number of chunks per generation, fits the 16-bit coefficients
+#define FOUNTAIN_SYMBOL_MAX_SIZE    (220U)  ///< Max size of a symbol, multiple of 4
+
+typedef struct {
+    uint8_t     symbols[FOUNTAIN_GENERATION_SIZE][FOUNTAIN_SYMBOL_MAX_SIZE] __attribute__((aligned(4)));  ///< Reduced symbols, indexed by pivot
+    uint16_t    coefficients[FOUNTAIN_GENERATION_SIZE]; ///< Reduced coefficients, indexed by pivot
+    uint16_t    pivots;                                 ///< Bit i is set when row i is present
+    uint32_t    generation;                             ///< Index of the generation being decoded
+    uint8_t     chunk_count;                            ///< Number of chunks in the generation
+    uint8_t     rank;                                   ///< Number of linearly independent symbols received
+    size_t      symbol_size;                            ///< Size of the symbols in bytes
+} fountain_decoder_t;
+
+//=========================== prototypes =======================================
+
+/**
+ * @brief Start decoding a generation, symbols received before are dropped
+ *
+ * @param[in] decoder       pointer to the decoder
+ * @param[in] generation    index of the generation
+ * @param[in] chunk_count   number of chunks in the generation (the last generation can be smaller)
+ * @param[in] symbol_size   size of the symbols, multiple of 4
+ */
+void fountain_init(fountain_decoder_t *decoder, uint32_t generation, uint8_t chunk_count, size_t symbol_size);
+
+/**
+ * @brief Add a received symbol
+ *
+ * @param[in] decoder       pointer to the decoder
+ * @param[in] coefficients  bit mask of the chunks combined in the symbol
+ * @param[in] symbol        symbol bytes, symbol_size long
+ *
+ * @return true if the symbol increased the rank, false if it is redundant or invalid
+ */
+bool fountain_add(fountain_decoder_t *decoder, uint16_t coefficients, const uint8_t *symbol);
+
+/**
+ * @brief Check if all chunks of the generation are decoded
+ *
+ * @param[in] decoder   pointer to the decoder
+ *
+ * @return true when fountain_chunk can be called for all chunks of the generation
+ */
+bool fountain_complete(const fountain_decoder_t *decoder);
+
+/**
+ * @brief Return a decoded chunk
+ *
+ * @param[in] decoder   pointer to the decoder
+ * @param[in] index     index of the chunk in the generation
+ *
+ * @return pointer to the chunk bytes, symbol_size long
+ */
+const uint8_t *fountain_chunk(const fountain_decoder_t *decoder, uint8_t index);
+
+#endif
@@ -1,4 +1,5 @@
 #include <nrf.h>
+#include <string.h>
 #include "ipc.h"
 
 /**
@@ -6,28 +7,79 @@
  */
 volatile __attribute__((section(".shared_data"))) ipc_shared_data_t ipc_shared_data;
 
-/**
- * @brief Lock the mutex, blocks until the mutex is locked
- */
-void mutex_lock(void) {
-    while (NRF_MUTEX_NS->MUTEX[0]) {}
+static volatile uint8_t _ipc_cmds_pending = 0;  ///< One bit per mailbox slot, set until its result is copied by ipc_network_wait
+
+void ipc_lock(ipc_lock_t lock) {
+    volatile ipc_lock_state_t *state = &ipc_shared_data.app_locks[lock];
+    // Reading the mutex takes it if it is free
+    if (NRF_MUTEX_NS->MUTEX[lock]) {
+        state->contended++;
+        state->waiting = true;
+        // The flag must be visible before the mutex is read again, or the release event could be missed
+        __DMB();
+        while (NRF_MUTEX_NS->MUTEX[lock]) {
+            __WFE();
+            state->wakeups++;
+        }
+        state->waiting = false;
+    }
+    state->acquired++;
 }
 
-/**
- * @brief Unlock the mutex, has no effect if the mutex is already unlocked
- */
-void mutex_unlock(void) {
-    NRF_MUTEX_NS->MUTEX[0] = 0;
+void ipc_unlock(ipc_lock_t lock) {
+    NRF_MUTEX_NS->MUTEX[lock] = 0;
+    __DMB();
+    if (ipc_shared_data.net_locks[lock].waiting) {
+        NRF_IPC_S->TASKS_SEND[IPC_CHAN_LOCK_RELEASE] = 1;
+    }
 }
 
-void ipc_network_call(ipc_req_t req) {
-    if (req != IPC_REQ_NONE) {
-        ipc_shared_data.req                 = req;
-        NRF_IPC_S->TASKS_SEND[IPC_CHAN_REQ] = 1;
+uint8_t ipc_network_post(ipc_req_t req, const void *args, uint8_t length) {
+    while (1) {
+        // Posters never preempt each other (see ipc.h), only the network core moves the tail concurrently
+        uint8_t head = ipc_shared_data.mailbox.head;
+        uint8_t slot = 1 << (head & (IPC_CMD_SLOTS - 1));
+        // A slot executed by the network core is only reused once its result was copied
+        if ((uint8_t)(head - ipc_shared_data.mailbox.tail) < IPC_CMD_SLOTS && !(_ipc_cmds_pending & slot)) {
+            _ipc_cmds_pending |= slot;
+            volatile ipc_cmd_t *cmd = &ipc_shared_data.mailbox.cmds[head & (IPC_CMD_SLOTS - 1)];
+            cmd->req = req;
+            cmd->length = length;
+            memcpy((void *)cmd->data, args, length);
+            // Publish the command before the new head
+            __DMB();
+            ipc_shared_data.mailbox.head = head + 1;
+            return head;
+        }
+        // Full, let the network core drain the queued commands
+        ipc_network_send();
     }
-    while (!ipc_shared_data.net_ack) {}
-    ipc_shared_data.net_ack = false;
-};
+}
+
+void ipc_network_send(void) {
+    NRF_IPC_S->TASKS_SEND[IPC_CHAN_REQ] = 1;
+}
+
+uint8_t ipc_network_wait(uint8_t seq, void *result, uint8_t length) {
+    // The command is complete once the tail moved past it
+    while ((int8_t)(ipc_shared_data.mailbox.tail - seq) <= 0) {}
+    // Read the result after the tail
+    __DMB();
+    volatile ipc_cmd_t *cmd = &ipc_shared_data.mailbox.cmds[seq & (IPC_CMD_SLOTS - 1)];
+    if (length > cmd->length) {
+        length = cmd->length;
+    }
+    memcpy(result, (const void *)cmd->data, length);
+    // Release the slot to the next posters
+    _ipc_cmds_pending &= ~(1 << (seq & (IPC_CMD_SLOTS - 1)));
+    return length;
+}
+
+void ipc_network_call(ipc_req_t req, void *data, uint8_t length) {
+    uint8_t seq = ipc_network_post(req, data, length);
+    ipc_network_send();
+    ipc_network_wait(seq, data, length);
+}
 
 void release_network_core(void) {
     // Do nothing if network core is already started and ready
@@ -0,0 +1,113 @@
+#ifndef __LOG_H
+#define __LOG_H
+
+/**
+ * @defgroup    swarmit_log     Deferred binary logging
+ * @ingroup     swarmit
+ * @brief       Log messages as a format address and raw arguments, formatted later
+ *
+ * Logging a message only copies the address of its format string and up to
+ * LOG_ARGS_MAX 32-bit arguments in a RAM ring buffer. Messages are formatted
+ * and printed when the main loop is idle, with log_flush. The format strings
+ * are kept in the .log_fmt flash section, a dump of the ring can also be decoded
+ * on the host from the ELF file.
+ *
+ * Messages less severe than LOG_LEVEL are removed at compile time, including
+ * their format string. Arguments are 32-bit words, 64-bit values and strings
+ * can't be logged.
+ *
+ * @{
+ * @file
+ * @author Anonymous Author <anon@anonymous.com>
+ * @copyright Anonymized Copyright, 2025
+ * @}
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+//=========================== defines ==========================================
+
+#define LOG_LEVEL_NONE      (0)
+#define LOG_LEVEL_ERROR     (1)
+#define LOG_LEVEL_WARNING   (2)
+#define LOG_LEVEL_INFO      (3)
+#define LOG_LEVEL_DEBUG     (4)
+
+#ifndef LOG_LEVEL
+#ifdef NDEBUG
+#define LOG_LEVEL           LOG_LEVEL_WARNING
+#else
+#define LOG_LEVEL           LOG_LEVEL_DEBUG
+#endif
+#endif
+
+#define LOG_ARGS_MAX        (4U)    ///< Maximum number of arguments of a message
+#define LOG_BUFFER_SIZE     (256U)  ///< Size of the ring buffer in 32-bit words, must be a power of 2
+
+#define _LOG_COUNT(_0, _1, _2, _3, _4, n, ...) n
+#define _LOG_NARGS(...) _LOG_COUNT(_0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define _LOG_ARGS_0()               0
+#define _LOG_ARGS_1(a)              (uint32_t)(a)
+#define _LOG_ARGS_2(a, b)           (uint32_t)(a), (uint32_t)(b)
+#define _LOG_ARGS_3(a, b, c)        (uint32_t)(a), (uint32_t)(b), (uint32_t)(c)
+#define _LOG_ARGS_4(a, b, c, d)     (uint32_t)(a), (uint32_t)(b), (uint32_t)(c), (uint32_t)(d)
+#define _LOG_CONCAT(a, b)           a##b
+#define _LOG_ARGS(n, ...)           _LOG_CONCAT(_LOG_ARGS_, n)(__VA_ARGS__)
+
+#define _LOG(fmt, ...)                                                                                  \
+    do {                                                                                                \
+        static const char _log_fmt[] __attribute__((section(".log_fmt"), aligned(4))) = fmt;            \
+        const uint32_t _log_args[LOG_ARGS_MAX] = { _LOG_ARGS(_LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__) }; \
+        log_write(_log_fmt, _log_args, _LOG_NARGS(__VA_ARGS__));                                        \
+    } while (0)
+
+#if LOG_LEVEL >= LOG_LEVEL_ERROR
+#define LOG_ERROR(fmt, ...)     _LOG(fmt, ##__VA_ARGS__)
+#else
+#define LOG_ERROR(fmt, ...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_WARNING
+#define LOG_WARNING(fmt, ...)   _LOG(fmt, ##__VA_ARGS__)
+#else
+#define LOG_WARNING(fmt, ...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_INFO
+#define LOG_INFO(fmt, ...)      _LOG(fmt, ##__VA_ARGS__)
+#else
+#define LOG_INFO(fmt, ...)
+#endif
+
+#if LOG_LEVEL >= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(fmt, ...)     _LOG(fmt, ##__VA_ARGS__)
+#else
+#define LOG_DEBUG(fmt, ...)
+#endif
+
+//=========================== prototypes =======================================
+
+/**
+ * @brief Append a message to the ring buffer, use the LOG_* macros instead
+ *
+ * The message is dropped if the ring buffer is full. Can be called from
+ * interrupts.
+ *
+ * @param[in] fmt       format string, must stay valid until the message is flushed
+ * @param[in] args      arguments of the message
+ * @param[in] count     number of arguments
+ */
+void log_write(const char *fmt, const uint32_t *args, size_t count);
+
+/**
+ * @brief Print the messages in the ring buffer, to be called when idle
+ */
+void log_flush(void);
+
+/**
+ * @brief Returns the number of messages dropped because the ring buffer was full
+ */
+uint32_t log_dropped(void);
+
+#endif
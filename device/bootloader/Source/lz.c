@@ -0,0 +1,102 @@
+/**
+ * @file
+ * @ingroup bootloader_lz
+ *
+ * @brief  Implementation of the streaming LZ decompression.
+ *
+ * @author Anonymous Author <anon@anonymous.com>
+ *
+ * @copyright Anonymized Copyright, 2025
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "lz.h"
+
+//=========================== defines ==========================================
+
+#define LZ_WINDOW_MASK          (LZ_WINDOW_SIZE - 1)
+#define LZ_LENGTH_EXTENDED      (15U)
+
+//=========================== private ==========================================
+
+static bool _read_length(const uint8_t *input, size_t length, size_t *index, uint32_t *value) {
+    if (*value != LZ_LENGTH_EXTENDED) {
+        return true;
+    }
+
+    uint8_t byte;
+    do {
+        if (*index >= length) {
+            return false;
+        }
+        byte = input[(*index)++];
+        *value += byte;
+    } while (byte == UINT8_MAX);
+
+    return true;
+}
+
+static inline void _output_byte(lz_decoder_t *decoder, uint8_t *output, size_t *output_index, uint8_t byte) {
+    output[(*output_index)++] = byte;
+    decoder->window[decoder->position++ & LZ_WINDOW_MASK] = byte;
+}
+
+//=========================== public ===========================================
+
+void lz_init(lz_decoder_t *decoder) {
+    decoder->position = 0;
+}
+
+bool lz_decompress(lz_decoder_t *decoder, const uint8_t *input, size_t length, uint8_t *output, size_t output_max, size_t *output_length) {
+    size_t index = 0;
+    size_t output_index = 0;
+
+    while (index < length) {
+        uint8_t token = input[index++];
+
+        // Literals
+        uint32_t literals_length = token >> 4;
+        if (!_read_length(input, length, &index, &literals_length)) {
+            return false;
+        }
+        if (literals_length > length - index || literals_length > output_max - output_index) {
+            return false;
+        }
+        for (uint32_t i = 0; i < literals_length; i++) {
+            _output_byte(decoder, output, &output_index, input[index++]);
+        }
+
+        // The last sequence of a block may have no match
+        if (index == length) {
+            break;
+        }
+
+        // Match
+        if (length - index < sizeof(uint16_t)) {
+            return false;
+        }
+        uint32_t offset = input[index] | (input[index + 1] << 8);
+        index += sizeof(uint16_t);
+        uint32_t match_length = token & 0x0f;
+        if (!_read_length(input, length, &index, &match_length)) {
+            return false;
+        }
+        match_length += LZ_MIN_MATCH_LENGTH;
+        if (offset == 0 || offset > LZ_WINDOW_SIZE || offset > decoder->position) {
+            return false;
+        }
+        if (match_length > output_max - output_index) {
+            return false;
+        }
+
+        // Byte per byte copy as the match can overlap the bytes it produces
+        for (uint32_t i = 0; i < match_length; i++) {
+            _output_byte(decoder, output, &output_index, decoder->window[(decoder->position - offset) & LZ_WINDOW_MASK]);
+        }
+    }
+
+    *output_length = output_index;
+    return true;
+}
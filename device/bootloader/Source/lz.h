@@ -0,0 +1,63 @@
+#ifndef __LZ_H
+#define __LZ_H
+
+/**
+ * @defgroup    bootloader_lz   LZ decompression
+ * @ingroup     bootloader
+ * @brief       Streaming decompression of compressed OTA images
+ *
+ * The compressed stream is a sequence of LZ4-like tokens: a token byte holds
+ * the literals length (high nibble) and the match length minus 4 (low nibble),
+ * both extended with additional bytes when equal to 15, followed by the
+ * literals and the 16-bit little endian match offset. A block may end right
+ * after literals, in which case the last sequence has no match.
+ *
+ * Each OTA chunk is a block of complete sequences but matches can reference
+ * any of the last LZ_WINDOW_SIZE bytes decompressed from previous chunks, so
+ * blocks must be decompressed in order.
+ *
+ * @{
+ * @file
+ * @author Anonymous Author <anon@anonymous.com>
+ * @copyright Anonymized Copyright, 2025
+ * @}
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+//=========================== defines ==========================================
+
+#define LZ_WINDOW_SIZE          (2048U)  ///< History window size, must be a power of 2
+#define LZ_MIN_MATCH_LENGTH     (4U)     ///< Shortest match encoded in a token
+
+typedef struct {
+    uint8_t  window[LZ_WINDOW_SIZE];    ///< Last decompressed bytes
+    uint32_t position;                  ///< Total number of bytes decompressed
+} lz_decoder_t;
+
+//=========================== prototypes =======================================
+
+/**
+ * @brief Reset the decoder history
+ *
+ * @param[in] decoder   pointer to the decoder
+ */
+void lz_init(lz_decoder_t *decoder);
+
+/**
+ * @brief Decompress a block of complete sequences
+ *
+ * @param[in]   decoder         pointer to the decoder
+ * @param[in]   input           compressed block
+ * @param[in]   length          length of the compressed block
+ * @param[out]  output          output buffer
+ * @param[in]   output_max      size of the output buffer
+ * @param[out]  output_length   number of bytes written in the output buffer
+ *
+ * @return true on success, false if the block is malformed or doesn't fit in the output buffer
+ */
+bool lz_decompress(lz_decoder_t *decoder, const uint8_t *input, size_t length, uint8_t *output, size_t output_max, size_t *output_length);
+
+#endif
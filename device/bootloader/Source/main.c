@@ -17,7 +17,8 @@
 
 #include "battery.h"
 #include "ipc.h"
-#include "nvmc.h"
+#include "log.h"
+#include "ota.h"
 #include "protocol.h"
 #include "mari.h"
 #include "tz.h"
@@ -30,9 +31,8 @@
 #include "move.h"
 #include "timer.h"
 
-#define SWARMIT_BASE_ADDRESS        (0x10000)
-
 #define BATTERY_UPDATE_DELAY        (1000U)
+#define OTA_BITMAP_REPORT_DELAY_MS  (200U)  ///< Max delay before reporting newly received chunks when acks are cumulative
 #define POSITION_UPDATE_DELAY_MS    (500U) ///< 100ms delay between each position update
 
 #define ROBOT_DISTANCE_THRESHOLD    (0.05)
@@ -48,11 +48,11 @@
 extern volatile __attribute__((section(".shared_data"))) ipc_shared_data_t ipc_shared_data;
 
 typedef struct {
-    uint8_t         notification_buffer[255]  __attribute__((aligned));
-    uint32_t        base_addr;
     bool            ota_start_request;
-    bool            ota_require_erase;
+    bool            ota_page_hashes_request;
     bool            ota_chunk_request;
+    bool            ota_status_request;
+    bool            ota_bitmap_report;
     bool            start_application;
     position_2d_t   last_position;
     bool            position_update;
@@ -153,7 +153,6 @@ static void setup_ns_user(void) {
     tz_configure_periph_non_secure(NRF_APPLICATION_PERIPH_ID_EGU2);
     tz_configure_periph_non_secure(NRF_APPLICATION_PERIPH_ID_EGU3);
     tz_configure_periph_non_secure(NRF_APPLICATION_PERIPH_ID_EGU4);
-    tz_configure_periph_non_secure(NRF_APPLICATION_PERIPH_ID_EGU5);
     tz_configure_periph_non_secure(NRF_APPLICATION_PERIPH_ID_PWM0);
     tz_configure_periph_dma_non_secure(NRF_APPLICATION_PERIPH_ID_PWM0);
     tz_configure_periph_non_secure(NRF_APPLICATION_PERIPH_ID_PWM1);
@@ -190,7 +189,6 @@ static void setup_ns_user(void) {
     NVIC_SetTargetState(EGU2_IRQn);
     NVIC_SetTargetState(EGU3_IRQn);
     NVIC_SetTargetState(EGU4_IRQn);
-    NVIC_SetTargetState(EGU5_IRQn);
     NVIC_SetTargetState(PWM0_IRQn);
     NVIC_SetTargetState(PWM1_IRQn);
     NVIC_SetTargetState(PWM2_IRQn);
@@ -235,7 +233,6 @@ static void setup_ns_user(void) {
 }
 
 static void _update_position(void) {
-    puts("Update position");
     _bootloader_vars.position_update = true;
 }
 
@@ -243,6 +240,10 @@ static void _read_battery(void) {
     _bootloader_vars.battery_update = true;
 }
 
+static void _report_ota_bitmap(void) {
+    _bootloader_vars.ota_bitmap_report = true;
+}
+
 static void _compute_angle(const position_2d_t *head, const position_2d_t *tail, int16_t *angle) {
     float dx = ((float)head->x / 1e6) - ((float)tail->x / 1e6);
     float dy = ((float)head->y / 1e6) - ((float)tail->y / 1e6);
@@ -346,6 +347,9 @@ int main(void) {
     // Configure non secure flash address space
     tz_configure_flash_non_secure(4, 60);
 
+    // Install the image received while the previous user image was running
+    ota_init();
+
     // Management code
     // Application mutex must be non secure because it's shared with the network which is itself non secure
     tz_configure_periph_non_secure(NRF_APPLICATION_PERIPH_ID_MUTEX);
@@ -357,20 +361,32 @@ int main(void) {
                             1 << IPC_CHAN_RADIO_RX |
                             1 << IPC_CHAN_OTA_START |
                             1 << IPC_CHAN_OTA_CHUNK |
+                            1 << IPC_CHAN_OTA_STATUS |
+                            1 << IPC_CHAN_OTA_PAGE_HASHES |
+                            1 << IPC_CHAN_LOCK_RELEASE |
                             1 << IPC_CHAN_APPLICATION_START
                             //1 << IPC_CHAN_APPLICATION_RESET
                         );
     NRF_IPC_S->SEND_CNF[IPC_CHAN_REQ]                   = 1 << IPC_CHAN_REQ;
     NRF_IPC_S->SEND_CNF[IPC_CHAN_LOG_EVENT]             = 1 << IPC_CHAN_LOG_EVENT;
+    NRF_IPC_S->SEND_CNF[IPC_CHAN_RADIO_TX]              = 1 << IPC_CHAN_RADIO_TX;
+    NRF_IPC_S->SEND_CNF[IPC_CHAN_ENTROPY]               = 1 << IPC_CHAN_ENTROPY;
+    NRF_IPC_S->SEND_CNF[IPC_CHAN_LOCK_RELEASE]          = 1 << IPC_CHAN_LOCK_RELEASE;
+    NRF_IPC_S->SEND_CNF[IPC_CHAN_LOG_RECORD]            = 1 << IPC_CHAN_LOG_RECORD;
     NRF_IPC_S->RECEIVE_CNF[IPC_CHAN_RADIO_RX]           = 1 << IPC_CHAN_RADIO_RX;
     NRF_IPC_S->RECEIVE_CNF[IPC_CHAN_APPLICATION_START]  = 1 << IPC_CHAN_APPLICATION_START;
     NRF_IPC_S->RECEIVE_CNF[IPC_CHAN_APPLICATION_STOP]   = 1 << IPC_CHAN_APPLICATION_STOP;
     //NRF_IPC_S->RECEIVE_CNF[IPC_CHAN_APPLICATION_RESET]  = 1 << IPC_CHAN_APPLICATION_RESET;
     NRF_IPC_S->RECEIVE_CNF[IPC_CHAN_OTA_START]          = 1 << IPC_CHAN_OTA_START;
     NRF_IPC_S->RECEIVE_CNF[IPC_CHAN_OTA_CHUNK]          = 1 << IPC_CHAN_OTA_CHUNK;
+    NRF_IPC_S->RECEIVE_CNF[IPC_CHAN_OTA_STATUS]         = 1 << IPC_CHAN_OTA_STATUS;
+    NRF_IPC_S->RECEIVE_CNF[IPC_CHAN_OTA_PAGE_HASHES]    = 1 << IPC_CHAN_OTA_PAGE_HASHES;
+    NRF_IPC_S->RECEIVE_CNF[IPC_CHAN_LOCK_RELEASE]       = 1 << IPC_CHAN_LOCK_RELEASE;
     NVIC_EnableIRQ(IPC_IRQn);
     NVIC_ClearPendingIRQ(IPC_IRQn);
     NVIC_SetPriority(IPC_IRQn, IPC_IRQ_PRIORITY);
+    // Locks are also taken from the IPC interrupt, the release event must wake up __WFE without preempting it
+    SCB->SCR |= SCB_SCR_SEVONPEND_Msk;
 
     // PPI connection: IPC_RECEIVE -> WDT_START
     NRF_IPC_S->PUBLISH_RECEIVE[IPC_CHAN_APPLICATION_STOP] = IPC_PUBLISH_RECEIVE_EN_Enabled << IPC_PUBLISH_RECEIVE_EN_Pos;
@@ -412,6 +428,8 @@ int main(void) {
         setup_watchdog0();
         NVIC_SetTargetState(IPC_IRQn);    // Used for radio RX
         NVIC_SetTargetState(SPIM4_IRQn);  // Used for LH2 localization
+        // EGU5 stays secure, its interrupt writes the images staged while the user image runs
+        ota_irq_init();
 
         // Set the vector table address prior to jumping to image
         SCB_NS->VTOR = (uint32_t)table;
@@ -428,9 +446,6 @@ int main(void) {
         while (1) {}
     }
 
-    _bootloader_vars.base_addr = SWARMIT_BASE_ADDRESS;
-    _bootloader_vars.ota_require_erase = true;
-
     // Initialize current angle to invalid value to force a recomputation when reset is called
     _control_loop_vars.direction = -1000;
     _control_loop_vars.target_reached = false;
@@ -447,58 +462,44 @@ int main(void) {
     db_timer_init(1);
     db_timer_set_periodic_ms(1, 1, POSITION_UPDATE_DELAY_MS, &_update_position);
     db_timer_set_periodic_ms(1, 2, BATTERY_UPDATE_DELAY, &_read_battery);
+    db_timer_set_periodic_ms(1, 3, OTA_BITMAP_REPORT_DELAY_MS, &_report_ota_bitmap);
 
     // Experiment is ready
     ipc_shared_data.status = SWRMT_APPLICATION_READY;
 
     while (1) {
+        // Print the pending log messages before sleeping
+        log_flush();
         __WFE();
 
         if (_bootloader_vars.ota_start_request) {
             _bootloader_vars.ota_start_request = false;
+            ota_start(false);
+        }
 
-            if (_bootloader_vars.ota_require_erase) {
-                // Erase non secure flash
-                uint32_t pages_count = (ipc_shared_data.ota.image_size / FLASH_PAGE_SIZE) + (ipc_shared_data.ota.image_size % FLASH_PAGE_SIZE != 0);
-                printf("Pages to erase: %u\n", pages_count);
-                for (uint32_t page = 0; page < pages_count; page++) {
-                    uint32_t addr = _bootloader_vars.base_addr + page * FLASH_PAGE_SIZE;
-                    printf("Erasing page %u at %p\n", page + 16, (uint32_t *)addr);
-                    nvmc_page_erase(page + 16);
-                }
-                printf("Erasing done\n");
-                _bootloader_vars.ota_require_erase = false;
-            }
-
-            // Notify erase is done
-            size_t length = 0;
-            _bootloader_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_OTA_START_ACK;
-            mari_node_tx(_bootloader_vars.notification_buffer, length);
+        if (_bootloader_vars.ota_page_hashes_request) {
+            _bootloader_vars.ota_page_hashes_request = false;
+            ota_send_page_hashes();
         }
 
         if (_bootloader_vars.ota_chunk_request) {
             _bootloader_vars.ota_chunk_request = false;
+            ota_process_chunks();
+        }
 
-            if (ipc_shared_data.ota.last_chunk_acked != (int32_t)ipc_shared_data.ota.chunk_index) {
-                // Write chunk to flash
-                uint32_t addr = _bootloader_vars.base_addr + ipc_shared_data.ota.chunk_index * SWRMT_OTA_CHUNK_SIZE;
-                printf("Writing chunk %d/%d at address %p\n", ipc_shared_data.ota.chunk_index, ipc_shared_data.ota.chunk_count - 1, (uint32_t *)addr);
-                nvmc_write((uint32_t *)addr, (void *)ipc_shared_data.ota.chunk, ipc_shared_data.ota.chunk_size);
-                _bootloader_vars.ota_require_erase = true;
-            }
+        if (_bootloader_vars.ota_status_request) {
+            _bootloader_vars.ota_status_request = false;
+            ota_send_chunks_bitmap();
+        }
 
-            // Notify chunk has been written
-            size_t length = 0;
-            _bootloader_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_OTA_CHUNK_ACK;
-            memcpy(_bootloader_vars.notification_buffer + length, (void *)&ipc_shared_data.ota.chunk_index, sizeof(uint32_t));
-            length += sizeof(uint32_t);
-            ipc_shared_data.ota.last_chunk_acked = ipc_shared_data.ota.chunk_index;
-            mari_node_tx(_bootloader_vars.notification_buffer, length);
+        if (_bootloader_vars.ota_bitmap_report) {
+            _bootloader_vars.ota_bitmap_report = false;
+            ota_report_chunks();
+        }
 
-            // If last chunk, finalize computed hash, set back to ready state
-            if (ipc_shared_data.ota.chunk_index == ipc_shared_data.ota.chunk_count - 1) {
-                ipc_shared_data.status = SWRMT_APPLICATION_READY;
-            }
+        if (ota_erase_next_page()) {
+            // Don't wait for the next event if pages are left to erase
+            __SEV();
         }
 
         if (_bootloader_vars.start_application) {
@@ -514,7 +515,7 @@ int main(void) {
         // Process available lighthouse data
         localization_process_data();
         if (_bootloader_vars.position_update) {
-            puts("Update position");
+            LOG_DEBUG("Update position\n");
             localization_get_position((position_2d_t *)&ipc_shared_data.current_position);
 
             if (ipc_shared_data.status != SWRMT_APPLICATION_RESETTING) {
@@ -572,8 +573,23 @@ void IPC_IRQHandler(void) {
         _bootloader_vars.ota_chunk_request = true;
     }
 
+    if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_STATUS]) {
+        NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_STATUS] = 0;
+        _bootloader_vars.ota_status_request = true;
+    }
+
+    if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_PAGE_HASHES]) {
+        NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_OTA_PAGE_HASHES] = 0;
+        _bootloader_vars.ota_page_hashes_request = true;
+    }
+
     if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_APPLICATION_START]) {
         NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_APPLICATION_START] = 0;
         _bootloader_vars.start_application = true;
     }
+
+    if (NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_LOCK_RELEASE]) {
+        // Only wakes up ipc_lock
+        NRF_IPC_S->EVENTS_RECEIVE[IPC_CHAN_LOCK_RELEASE] = 0;
+    }
 }
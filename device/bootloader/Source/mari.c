@@ -29,12 +29,40 @@ void mari_init(void) {
     // APPMUTEX (address at 0x41030000 => periph ID is 48)
     tz_configure_periph_non_secure(NRF_APPLICATION_PERIPH_ID_MUTEX);
 
+    // PDUs received before a reset of the application core are dropped
+    ipc_shared_data.rx_ring.tail = ipc_shared_data.rx_ring.head;
+    // Deliver all packets right away until the user image sets its policy
+    ipc_shared_data.rx_filter.enabled = false;
+    ipc_shared_data.rx_filter.batch_size = 0;
+    ipc_shared_data.tx_ring.dropped = 0;
+
     // Initialize TDMA client drv in the net-core
-    ipc_network_call(IPC_MARI_INIT_REQ);
+    ipc_network_call(IPC_MARI_INIT_REQ, NULL, 0);
+}
+
+uint8_t mari_node_tx(const uint8_t *packet, uint8_t length) {
+    // OTA notifications are also sent from the IPC interrupt, claim the slot atomically
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint8_t head = ipc_shared_data.tx_ring.head;
+    if ((uint8_t)(head - ipc_shared_data.tx_ring.tail) >= IPC_RADIO_PDU_SLOTS) {
+        ipc_shared_data.tx_ring.dropped++;
+        __set_PRIMASK(primask);
+        return 0;
+    }
+    volatile ipc_radio_pdu_t *pdu = &ipc_shared_data.tx_ring.pdus[head & (IPC_RADIO_PDU_SLOTS - 1)];
+    pdu->length = length;
+    memcpy((void *)pdu->buffer, packet, length);
+    // Publish the slot content before the new head
+    __DMB();
+    ipc_shared_data.tx_ring.head = head + 1;
+    __set_PRIMASK(primask);
+
+    // Don't wait for the network core, it sends the queued PDUs once connected
+    NRF_IPC_S->TASKS_SEND[IPC_CHAN_RADIO_TX] = 1;
+    return mari_node_tx_pending();
 }
 
-void mari_node_tx(const uint8_t *packet, uint8_t length) {
-    ipc_shared_data.tx_pdu.length = length;
-    memcpy((void *)ipc_shared_data.tx_pdu.buffer, packet, length);
-    ipc_network_call(IPC_MARI_NODE_TX_REQ);
+uint8_t mari_node_tx_pending(void) {
+    return ipc_shared_data.tx_ring.head - ipc_shared_data.tx_ring.tail;
 }
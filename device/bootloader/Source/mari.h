@@ -24,12 +24,18 @@
 void mari_init(void);
 
 /**
- * @brief Queues a single node packet to send through mari
+ * @brief Queues a single node packet to send through mari, returns without waiting for the network core
  *
  * @param[in] packet pointer to the array of data to send over the radio
  * @param[in] length Number of bytes to send
  *
+ * @return Number of packets waiting to be sent, including this one, 0 if the queue is full and the packet is dropped
  */
-void mari_node_tx(const uint8_t *packet, uint8_t length);
+uint8_t mari_node_tx(const uint8_t *packet, uint8_t length);
+
+/**
+ * @brief Returns the number of queued packets not yet sent by the network core
+ */
+uint8_t mari_node_tx_pending(void);
 
 #endif
@@ -9,8 +9,10 @@
  * @copyright Anonymized Copyright, 2023
  */
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
 
 #include <nrf.h>
 #include "nvmc.h"
@@ -34,7 +36,76 @@ void nvmc_write(const uint32_t *addr, const void *data, size_t len) {
     NRF_NVMC_S->CONFIGNS = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
     for (uint32_t i = 0; i < (len >> 2); i++) {
         *dest_addr++ = data_addr[i];
+        while (!NRF_NVMC_S->READY) {}
     }
 
     NRF_NVMC_S->CONFIGNS = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
 }
+
+bool nvmc_page_update(uint32_t page, const void *data) {
+
+    volatile uint32_t *flash = (uint32_t *)(page * FLASH_PAGE_SIZE);
+    const uint32_t    *words = data;
+
+    // Words can only be programmed once between erases
+    bool erase = false;
+    for (uint32_t i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (flash[i] != words[i] && flash[i] != 0xFFFFFFFF) {
+            erase = true;
+            break;
+        }
+    }
+    if (erase) {
+        nvmc_page_erase(page);
+    }
+
+    NRF_NVMC_S->CONFIGNS = (NVMC_CONFIG_WEN_Wen << NVMC_CONFIG_WEN_Pos);
+    for (uint32_t i = 0; i < FLASH_PAGE_SIZE / sizeof(uint32_t); i++) {
+        if (flash[i] != words[i]) {
+            flash[i] = words[i];
+            while (!NRF_NVMC_S->READY) {}
+        }
+    }
+
+    NRF_NVMC_S->CONFIGNS = (NVMC_CONFIG_WEN_Ren << NVMC_CONFIG_WEN_Pos);
+    return erase;
+}
+
+void nvmc_writer_init(nvmc_page_writer_t *writer) {
+    writer->page = NVMC_WRITER_PAGE_NONE;
+    writer->dirty = false;
+}
+
+void nvmc_writer_write(nvmc_page_writer_t *writer, uint32_t addr, const void *data, size_t length) {
+
+    const uint8_t *input = data;
+
+    while (length) {
+        uint32_t page = addr / FLASH_PAGE_SIZE;
+        if (page != writer->page) {
+            // Bytes not written keep their current value
+            nvmc_writer_flush(writer);
+            memcpy(writer->data, (const void *)(page * FLASH_PAGE_SIZE), FLASH_PAGE_SIZE);
+            writer->page = page;
+        }
+
+        uint32_t offset = addr % FLASH_PAGE_SIZE;
+        size_t   size   = FLASH_PAGE_SIZE - offset;
+        if (size > length) {
+            size = length;
+        }
+        memcpy(&writer->data[offset], input, size);
+        writer->dirty = true;
+
+        addr   += size;
+        input  += size;
+        length -= size;
+    }
+}
+
+void nvmc_writer_flush(nvmc_page_writer_t *writer) {
+    if (writer->page != NVMC_WRITER_PAGE_NONE && writer->dirty) {
+        nvmc_page_update(writer->page, writer->data);
+    }
+    writer->dirty = false;
+}
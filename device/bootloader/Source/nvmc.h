@@ -1,6 +1,7 @@
 #ifndef __NVMC_H
 #define __NVMC_H
 
+#include <stdbool.h>
 #include <stdlib.h>
 #include <stdint.h>
 
@@ -8,10 +9,55 @@
 
 #define FLASH_PAGE_SIZE 4096
 #define FLASH_OFFSET 0x0
+#define NVMC_WRITER_PAGE_NONE   (UINT32_MAX)
+
+/// Buffers the writes to a flash page, the page is programmed once the writes move to another page
+typedef struct {
+    uint8_t     data[FLASH_PAGE_SIZE] __attribute__((aligned(4)));  ///< Content of the buffered page
+    uint32_t    page;       ///< Index of the buffered page, NVMC_WRITER_PAGE_NONE when empty
+    bool        dirty;      ///< The buffer was written since the page was last programmed
+} nvmc_page_writer_t;
 
 //=========================== public ===========================================
 
 void nvmc_page_erase(uint32_t page);
 void nvmc_write(const uint32_t *addr, const void *input, size_t len);
 
+/**
+ * @brief Program a page with new content
+ *
+ * Only the words that differ are written. The page is erased first only if
+ * a differing word isn't in the erased state.
+ *
+ * @param[in] page  index of the page
+ * @param[in] data  new content of the page, word aligned
+ *
+ * @return true if the page was erased
+ */
+bool nvmc_page_update(uint32_t page, const void *data);
+
+/**
+ * @brief Drop the buffered page without programming it
+ *
+ * @param[in] writer    pointer to the writer
+ */
+void nvmc_writer_init(nvmc_page_writer_t *writer);
+
+/**
+ * @brief Write bytes at any address, the buffered page is programmed when bytes of another page are written
+ *
+ * @param[in] writer    pointer to the writer
+ * @param[in] addr      flash address of the first byte
+ * @param[in] data      bytes to write
+ * @param[in] length    number of bytes
+ */
+void nvmc_writer_write(nvmc_page_writer_t *writer, uint32_t addr, const void *data, size_t length);
+
+/**
+ * @brief Program the buffered page if it was written, with nvmc_page_update
+ *
+ * @param[in] writer    pointer to the writer
+ */
+void nvmc_writer_flush(nvmc_page_writer_t *writer);
+
 #endif
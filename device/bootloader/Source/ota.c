@@ -0,0 +1,722 @@
+/**
+ * @file
+ * @ingroup bootloader_ota
+ *
+ * @brief  Implementation of the OTA programming.
+ *
+ * @author Anonymous Author <anon@anonymous.com>
+ *
+ * @copyright Anonymized Copyright, 2025
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <nrf.h>
+
+#include "delta.h"
+#include "fountain.h"
+#include "ipc.h"
+#include "log.h"
+#include "lz.h"
+#include "mari.h"
+#include "nvmc.h"
+#include "ota.h"
+#include "protocol.h"
+
+// DotBot-firmware includes
+#include "sha256.h"
+
+//=========================== defines ==========================================
+
+#define OTA_STAGING_MAGIC   (0x5357534EUL)  ///< Marks a complete staged image, erased flash otherwise
+#define OTA_IMAGE_MAGIC     (0x53574948UL)  ///< Marks the hash of a completely programmed image, erased flash otherwise
+#define OTA_IRQn            (EGU5_IRQn)     ///< Secure interrupt handling the OTA requests while the user image runs
+#define OTA_IRQ_PRIORITY    (7)             ///< Lowest priority, only preempts the user image main loop and its lowest priority interrupts
+
+typedef struct __attribute__((aligned(4))) {
+    uint32_t    magic;                              ///< OTA_STAGING_MAGIC when an image is staged
+    uint32_t    image_size;                         ///< Size of the staged image
+    uint8_t     pages[SWRMT_OTA_PAGES_BITMAP_SIZE]; ///< Bitmap of the staged pages to install
+} ota_staging_info_t;
+
+typedef struct __attribute__((aligned(4))) {
+    uint32_t    magic;                              ///< OTA_IMAGE_MAGIC when the installed image is known
+    uint32_t    image_size;                         ///< Size of the installed image
+    uint8_t     hash[SWRMT_OTA_SHA256_LENGTH];      ///< SHA256 of the installed image
+} ota_image_info_t;
+
+typedef struct {
+    uint32_t    image_size;
+    uint32_t    chunk_count;
+    uint8_t     chunk_size;
+    uint8_t     ack_interval;
+    uint8_t     mode;
+    uint32_t    base_size;
+    uint8_t     base_hash[8];
+    uint8_t     pages[SWRMT_OTA_PAGES_BITMAP_SIZE];
+    uint8_t     image_hash[SWRMT_IMAGE_HASH_LENGTH];
+} ota_params_t;
+
+typedef struct {
+    uint8_t         notification_buffer[255]  __attribute__((aligned));
+    ota_params_t    params;                 ///< Copy of the start request parameters, the network core may overwrite the shared ones at any time
+    uint32_t        image_addr;             ///< Address of the slot receiving the image
+    bool            staging;                ///< The image is received in the staging slot
+    bool            transfer_active;        ///< Set once a start request is accepted, chunks are dropped otherwise
+    bool            transfer_complete;      ///< All chunks of the last accepted transfer are written, its bitmap can still be requested
+    bool            require_erase;
+    uint8_t         pages_erased[SWRMT_OTA_PAGES_BITMAP_SIZE];  ///< Bitmap of pages erased since the last start, only written by this transfer since
+    uint32_t        erase_page;             ///< Next page checked by the background erase
+    uint32_t        erase_pages_count;      ///< Number of pages covered by the background erase
+    uint8_t         chunks_received[SWARMIT_OTA_MAX_CHUNKS / 8];  ///< Bitmap of chunks already written to flash
+    uint32_t        chunks_received_count;
+    uint32_t        chunks_unreported;      ///< Chunks written since the last bitmap notification
+    lz_decoder_t    lz_decoder;
+    uint8_t         lz_output[SWRMT_OTA_LZ_BLOCK_MAX_SIZE];
+    uint32_t        lz_offset;              ///< Number of decompressed bytes written to flash
+    union {                                 ///< Delta and fountain modes can't be combined
+        delta_patcher_t     delta_patcher;
+        fountain_decoder_t  fountain_decoder;
+    };
+    nvmc_page_writer_t writer;              ///< Only programs the words that changed, erases pages only when needed
+    volatile bool   start_requested;        ///< Requests received while the user image runs, handled from OTA_IRQn
+    volatile bool   erase_requested;
+    volatile bool   bitmap_requested;
+    volatile bool   page_hashes_requested;
+} ota_vars_t;
+
+//=========================== variables ========================================
+
+extern volatile __attribute__((section(".shared_data"))) ipc_shared_data_t ipc_shared_data;
+
+static ota_vars_t _ota_vars = { 0 };
+
+//=========================== private ==========================================
+
+static inline bool _ota_chunk_received(uint32_t index) {
+    return _ota_vars.chunks_received[index >> 3] & (1 << (index & 0x07));
+}
+
+static inline void _ota_set_chunk_received(uint32_t index) {
+    _ota_vars.chunks_received[index >> 3] |= (1 << (index & 0x07));
+}
+
+static inline bool _ota_page_selected(uint32_t page) {
+    return _ota_vars.params.pages[page >> 3] & (1 << (page & 0x07));
+}
+
+static inline bool _ota_page_erased(uint32_t page) {
+    return _ota_vars.pages_erased[page >> 3] & (1 << (page & 0x07));
+}
+
+static void _ota_erase_page(uint32_t page) {
+    if (!_ota_page_selected(page) || _ota_page_erased(page)) {
+        return;
+    }
+    uint32_t addr = _ota_vars.image_addr + page * FLASH_PAGE_SIZE;
+    LOG_DEBUG("Erasing page %u at %p\n", addr / FLASH_PAGE_SIZE, (uint32_t *)addr);
+    nvmc_page_erase(addr / FLASH_PAGE_SIZE);
+    _ota_vars.pages_erased[page >> 3] |= (1 << (page & 0x07));
+}
+
+static void _ota_end(void) {
+    _ota_vars.transfer_active = false;
+    // The user image keeps running while an image is staged
+    if (!_ota_vars.staging) {
+        ipc_shared_data.status = SWRMT_APPLICATION_READY;
+    }
+}
+
+static bool _ota_write(uint32_t offset, const void *data, size_t length) {
+    // The staging slot is followed by the image info page, nothing is written past the slot
+    if (offset > SWARMIT_IMAGE_MAX_SIZE || length > SWARMIT_IMAGE_MAX_SIZE - offset) {
+        LOG_ERROR("Write past the image slot at offset %u\n", offset);
+        _ota_end();
+        return false;
+    }
+    if (!(_ota_vars.params.mode & (SWRMT_OTA_MODE_LZ | SWRMT_OTA_MODE_DELTA))) {
+        // Raw chunks and decoded generations are written in any order, a page is erased before its
+        // first chunk so the writer finds it blank each time it comes back to it and never erases it again
+        for (uint32_t page = offset / FLASH_PAGE_SIZE; page <= (offset + length - 1) / FLASH_PAGE_SIZE; page++) {
+            _ota_erase_page(page);
+        }
+    }
+    nvmc_writer_write(&_ota_vars.writer, _ota_vars.image_addr + offset, data, length);
+    return true;
+}
+
+static void _ota_erase_init(void) {
+    // Pages erased by a previous start are still blank if no chunk was written since
+    if (_ota_vars.require_erase) {
+        memset(_ota_vars.pages_erased, 0, sizeof(_ota_vars.pages_erased));
+        _ota_vars.require_erase = false;
+    }
+
+    _ota_vars.erase_page = 0;
+    _ota_vars.erase_pages_count = (_ota_vars.params.image_size / FLASH_PAGE_SIZE) + (_ota_vars.params.image_size % FLASH_PAGE_SIZE != 0);
+}
+
+static void _ota_erase_next_page(void) {
+    // Erase at most one page per call so radio events are handled between page erases
+    while (_ota_vars.erase_page < _ota_vars.erase_pages_count) {
+        uint32_t page = _ota_vars.erase_page++;
+        if (_ota_page_selected(page) && !_ota_page_erased(page)) {
+            _ota_erase_page(page);
+            break;
+        }
+    }
+
+    if (_ota_vars.erase_page == _ota_vars.erase_pages_count) {
+        LOG_DEBUG("Erasing done\n");
+    }
+}
+
+static void _ota_skip_unselected_chunks(void) {
+    // Chunks of unchanged pages are not sent, consider them received
+    for (uint32_t chunk = 0; chunk < _ota_vars.params.chunk_count; chunk++) {
+        uint32_t first_page = (chunk * _ota_vars.params.chunk_size) / FLASH_PAGE_SIZE;
+        uint32_t last_page = ((chunk + 1) * _ota_vars.params.chunk_size - 1) / FLASH_PAGE_SIZE;
+        if (!_ota_page_selected(first_page) && !_ota_page_selected(last_page)) {
+            _ota_set_chunk_received(chunk);
+            _ota_vars.chunks_received_count++;
+        }
+    }
+}
+
+static void _ota_stage_image(void) {
+    // Record the complete image so it is installed at the next boot
+    if (*(const uint32_t *)SWARMIT_STAGING_INFO_ADDRESS == OTA_STAGING_MAGIC) {
+        return;
+    }
+    ota_staging_info_t info = { 0 };
+    info.magic = OTA_STAGING_MAGIC;
+    info.image_size = _ota_vars.params.image_size;
+    if (_ota_vars.params.mode & SWRMT_OTA_MODE_DELTA) {
+        // The delta patch rewrites the whole image
+        memset(info.pages, 0xff, sizeof(info.pages));
+    } else {
+        memcpy(info.pages, _ota_vars.params.pages, sizeof(info.pages));
+    }
+    nvmc_write((uint32_t *)SWARMIT_STAGING_INFO_ADDRESS, &info, sizeof(info));
+    LOG_INFO("Image staged, installed at next start\n");
+}
+
+static void _ota_clear_info(uint32_t addr) {
+    if (*(const uint32_t *)addr != 0xFFFFFFFF) {
+        nvmc_page_erase(addr / FLASH_PAGE_SIZE);
+    }
+}
+
+static void _ota_store_image_info(uint32_t image_size) {
+    // Hash the image actually in flash, reported in the status notifications
+    ota_image_info_t info = { 0 };
+    info.magic = OTA_IMAGE_MAGIC;
+    info.image_size = image_size;
+    crypto_sha256_init();
+    crypto_sha256_update((const uint8_t *)SWARMIT_BASE_ADDRESS, image_size);
+    crypto_sha256(info.hash);
+    _ota_clear_info(SWARMIT_IMAGE_INFO_ADDRESS);
+    nvmc_write((uint32_t *)SWARMIT_IMAGE_INFO_ADDRESS, &info, sizeof(info));
+    memcpy((uint8_t *)ipc_shared_data.image_hash, info.hash, SWRMT_IMAGE_HASH_LENGTH);
+}
+
+static void _ota_clear_image_info(void) {
+    _ota_clear_info(SWARMIT_IMAGE_INFO_ADDRESS);
+    memset((uint8_t *)ipc_shared_data.image_hash, 0, SWRMT_IMAGE_HASH_LENGTH);
+}
+
+static bool _ota_image_installed(void) {
+    static const uint8_t unknown[SWRMT_IMAGE_HASH_LENGTH] = { 0 };
+    return memcmp((const uint8_t *)ipc_shared_data.image_hash, unknown, SWRMT_IMAGE_HASH_LENGTH) != 0 &&
+           memcmp((const uint8_t *)ipc_shared_data.image_hash, _ota_vars.params.image_hash, SWRMT_IMAGE_HASH_LENGTH) == 0;
+}
+
+static void _ota_done(void) {
+    // Program the last written page
+    nvmc_writer_flush(&_ota_vars.writer);
+    _ota_vars.transfer_complete = true;
+    if (_ota_vars.staging) {
+        _ota_stage_image();
+    } else {
+        _ota_store_image_info(_ota_vars.params.image_size);
+    }
+    _ota_end();
+}
+
+static void _ota_send_start_ack(void) {
+    size_t length = 0;
+    _ota_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_OTA_START_ACK;
+    swrmt_ota_start_ack_t *notification = (swrmt_ota_start_ack_t *)&_ota_vars.notification_buffer[length];
+    // Fixed for now: all devices share the same Mari payload size, so the controller default already matches it
+    notification->chunk_size_max = SWRMT_OTA_CHUNK_SIZE_MAX;
+    length += sizeof(swrmt_ota_start_ack_t);
+    mari_node_tx(_ota_vars.notification_buffer, length);
+}
+
+static bool _ota_check_base_image(void) {
+    if (_ota_vars.params.base_size > SWARMIT_IMAGE_MAX_SIZE) {
+        return false;
+    }
+
+    uint8_t hash[SWRMT_OTA_SHA256_LENGTH];
+    crypto_sha256_init();
+    crypto_sha256_update((const uint8_t *)SWARMIT_BASE_ADDRESS, _ota_vars.params.base_size);
+    crypto_sha256(hash);
+    return memcmp(hash, _ota_vars.params.base_hash, sizeof(_ota_vars.params.base_hash)) == 0;
+}
+
+static bool _ota_write_lz_output(uint32_t chunk_index, size_t length) {
+    if (_ota_vars.lz_offset + length > _ota_vars.params.image_size) {
+        LOG_ERROR("Decompressed image larger than %u bytes\n", _ota_vars.params.image_size);
+        return false;
+    }
+
+    LOG_DEBUG("Writing compressed chunk %d/%d at address %p\n", chunk_index, _ota_vars.params.chunk_count - 1, (uint32_t *)(_ota_vars.image_addr + _ota_vars.lz_offset));
+    if (!_ota_write(_ota_vars.lz_offset, _ota_vars.lz_output, length)) {
+        return false;
+    }
+    _ota_vars.lz_offset += length;
+    return true;
+}
+
+static bool _ota_write_stream_chunk(const ipc_ota_chunk_t *chunk) {
+    uint32_t chunk_index = chunk->index;
+
+    // Compressed and delta chunks depend on the chunks before them, only the next chunk can be written
+    if (chunk_index != _ota_vars.chunks_received_count) {
+        return false;
+    }
+
+    const uint8_t *data = chunk->data;
+    size_t length = chunk->size;
+
+    if (_ota_vars.params.mode & SWRMT_OTA_MODE_LZ) {
+        if (!lz_decompress(&_ota_vars.lz_decoder, data, length, _ota_vars.lz_output, SWRMT_OTA_LZ_BLOCK_MAX_SIZE, &length)) {
+            // The decoder window already holds the partial output, the transfer can't resume from this chunk
+            LOG_ERROR("Invalid compressed chunk %u\n", chunk_index);
+            _ota_end();
+            return false;
+        }
+        if (!(_ota_vars.params.mode & SWRMT_OTA_MODE_DELTA)) {
+            return _ota_write_lz_output(chunk_index, length);
+        }
+        data = _ota_vars.lz_output;
+    }
+
+    LOG_DEBUG("Applying delta chunk %d/%d\n", chunk_index, _ota_vars.params.chunk_count - 1);
+    if (!delta_apply(&_ota_vars.delta_patcher, data, length)) {
+        LOG_ERROR("Invalid delta chunk %u\n", chunk_index);
+        _ota_end();
+        return false;
+    }
+    if (chunk_index == _ota_vars.params.chunk_count - 1 && !delta_finish(&_ota_vars.delta_patcher)) {
+        LOG_ERROR("Incomplete delta patch\n");
+        _ota_end();
+        return false;
+    }
+    return true;
+}
+
+static void _ota_send_chunks_bitmap(void) {
+    uint32_t chunk_count = _ota_vars.params.chunk_count;
+
+    // Skip the leading fully received bytes, chunks below base are all acknowledged
+    uint32_t base = 0;
+    while (base < chunk_count && _ota_vars.chunks_received[base >> 3] == 0xff) {
+        base += 8;
+    }
+    if (base > chunk_count) {
+        base = chunk_count;
+    }
+
+    uint32_t count = ((chunk_count - base) + 7) >> 3;
+    if (count > SWRMT_OTA_BITMAP_MAX_SIZE) {
+        count = SWRMT_OTA_BITMAP_MAX_SIZE;
+    }
+
+    size_t length = 0;
+    _ota_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_OTA_CHUNK_BITMAP;
+    swrmt_ota_chunk_bitmap_t *notification = (swrmt_ota_chunk_bitmap_t *)&_ota_vars.notification_buffer[length];
+    notification->base = base;
+    notification->count = count;
+    memcpy(notification->bitmap, &_ota_vars.chunks_received[base >> 3], count);
+    length += sizeof(uint32_t) + sizeof(uint8_t) + count;
+    mari_node_tx(_ota_vars.notification_buffer, length);
+    _ota_vars.chunks_unreported = 0;
+}
+
+static void _ota_decode_symbol(const ipc_ota_chunk_t *symbol) {
+    uint32_t generation = symbol->index >> 16;
+    uint32_t first_chunk = generation * SWRMT_OTA_FOUNTAIN_GENERATION_SIZE;
+    uint32_t chunk_size = _ota_vars.params.chunk_size;
+
+    // Symbols of generations already decoded are not needed anymore
+    if (first_chunk >= _ota_vars.params.chunk_count || _ota_chunk_received(first_chunk) || symbol->size != chunk_size) {
+        return;
+    }
+
+    fountain_decoder_t *decoder = &_ota_vars.fountain_decoder;
+    if (decoder->generation != generation) {
+        // Only one generation is decoded at a time, symbols received for another one are dropped
+        uint32_t chunk_count = _ota_vars.params.chunk_count - first_chunk;
+        if (chunk_count > SWRMT_OTA_FOUNTAIN_GENERATION_SIZE) {
+            chunk_count = SWRMT_OTA_FOUNTAIN_GENERATION_SIZE;
+        }
+        fountain_init(decoder, generation, chunk_count, chunk_size);
+    }
+    if (!fountain_add(decoder, symbol->index & 0xffff, symbol->data) || !fountain_complete(decoder)) {
+        return;
+    }
+
+    LOG_DEBUG("Writing decoded generation %u\n", generation);
+    for (uint8_t index = 0; index < decoder->chunk_count; index++) {
+        uint32_t chunk_index = first_chunk + index;
+        uint32_t offset = chunk_index * chunk_size;
+        // The padding of the last chunk is not written
+        uint32_t length = _ota_vars.params.image_size - offset;
+        if (length > chunk_size) {
+            length = chunk_size;
+        }
+        if (!_ota_write(offset, fountain_chunk(decoder, index), length)) {
+            return;
+        }
+        _ota_set_chunk_received(chunk_index);
+        _ota_vars.chunks_received_count++;
+    }
+    _ota_vars.require_erase = true;
+
+    // Symbols are not acknowledged, only report once the whole image is written
+    if (_ota_vars.chunks_received_count == _ota_vars.params.chunk_count) {
+        _ota_send_chunks_bitmap();
+        _ota_done();
+    }
+}
+
+static void _ota_process_chunk(ipc_ota_chunk_t *chunk) {
+    if (_ota_vars.params.mode & SWRMT_OTA_MODE_FOUNTAIN) {
+        _ota_decode_symbol(chunk);
+        return;
+    }
+
+    // Chunks may arrive out of order and be retransmitted
+    uint32_t chunk_index = chunk->index;
+    bool chunk_written = _ota_chunk_received(chunk_index);
+    if (!chunk_written) {
+        if (_ota_vars.params.mode != SWRMT_OTA_MODE_RAW) {
+            chunk_written = _ota_write_stream_chunk(chunk);
+        } else {
+            // Write chunk to flash
+            uint32_t offset = chunk_index * _ota_vars.params.chunk_size;
+            LOG_DEBUG("Writing chunk %d/%d at address %p\n", chunk_index, _ota_vars.params.chunk_count - 1, (uint32_t *)(_ota_vars.image_addr + offset));
+            chunk_written = _ota_write(offset, chunk->data, chunk->size);
+        }
+        if (chunk_written) {
+            _ota_set_chunk_received(chunk_index);
+            _ota_vars.chunks_received_count++;
+            _ota_vars.require_erase = true;
+        }
+    }
+
+    bool ota_done = (_ota_vars.chunks_received_count == _ota_vars.params.chunk_count);
+
+    // Out of order compressed chunks are dropped without acknowledgment
+    if (chunk_written && _ota_vars.params.ack_interval == 0) {
+        // Notify chunk has been written
+        size_t length = 0;
+        _ota_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_OTA_CHUNK_ACK;
+        memcpy(_ota_vars.notification_buffer + length, &chunk_index, sizeof(uint32_t));
+        length += sizeof(uint32_t);
+        mari_node_tx(_ota_vars.notification_buffer, length);
+    } else if (chunk_written && (++_ota_vars.chunks_unreported >= _ota_vars.params.ack_interval || ota_done)) {
+        // Cumulative acknowledgment of all chunks received so far
+        _ota_send_chunks_bitmap();
+    }
+
+    // If all chunks are written, set back to ready state
+    if (ota_done) {
+        _ota_done();
+    }
+}
+
+static bool _ota_process_next_chunk(void) {
+    uint8_t tail = ipc_shared_data.ota.chunks_tail;
+    if (tail == ipc_shared_data.ota.chunks_head) {
+        return false;
+    }
+    // Read the slot content only after the head was read
+    __DMB();
+    // Chunks received without an accepted start request are dropped
+    if (_ota_vars.transfer_active) {
+        _ota_process_chunk((ipc_ota_chunk_t *)&ipc_shared_data.ota.chunks[tail & (IPC_OTA_CHUNK_SLOTS - 1)]);
+    }
+    // Release the slot once it is written to flash
+    __DMB();
+    ipc_shared_data.ota.chunks_tail = tail + 1;
+    return true;
+}
+
+static bool _ota_work_pending(void) {
+    return _ota_vars.start_requested || _ota_vars.erase_requested || _ota_vars.bitmap_requested || _ota_vars.page_hashes_requested ||
+           ipc_shared_data.ota.chunks_tail != ipc_shared_data.ota.chunks_head;
+}
+
+//=========================== public ===========================================
+
+void ota_init(void) {
+    _ota_vars.image_addr = SWARMIT_BASE_ADDRESS;
+    _ota_vars.require_erase = true;
+
+    const ota_image_info_t *image_info = (const ota_image_info_t *)SWARMIT_IMAGE_INFO_ADDRESS;
+    if (image_info->magic == OTA_IMAGE_MAGIC) {
+        memcpy((uint8_t *)ipc_shared_data.image_hash, image_info->hash, SWRMT_IMAGE_HASH_LENGTH);
+    } else {
+        // Image programmed with a debugger
+        memset((uint8_t *)ipc_shared_data.image_hash, 0, SWRMT_IMAGE_HASH_LENGTH);
+    }
+
+    const ota_staging_info_t *info = (const ota_staging_info_t *)SWARMIT_STAGING_INFO_ADDRESS;
+    if (info->magic != OTA_STAGING_MAGIC) {
+        return;
+    }
+
+    if (info->image_size <= SWARMIT_IMAGE_MAX_SIZE) {
+        LOG_INFO("Installing staged image (%u bytes)\n", info->image_size);
+        _ota_clear_image_info();
+        for (uint32_t page = 0; page * FLASH_PAGE_SIZE < info->image_size; page++) {
+            if (!(info->pages[page >> 3] & (1 << (page & 0x07)))) {
+                continue;
+            }
+            // Pages already copied before a reset are left untouched
+            nvmc_page_update((SWARMIT_BASE_ADDRESS / FLASH_PAGE_SIZE) + page, (const uint8_t *)(SWARMIT_STAGING_ADDRESS + page * FLASH_PAGE_SIZE));
+        }
+        _ota_store_image_info(info->image_size);
+    }
+    _ota_clear_info(SWARMIT_STAGING_INFO_ADDRESS);
+}
+
+void ota_start(bool staging) {
+    // The state of the previous transfer is only valid again once this one is accepted
+    _ota_vars.transfer_active = false;
+    _ota_vars.transfer_complete = false;
+
+    if (staging != _ota_vars.staging) {
+        // Pages erased by a previous start are in the other slot
+        _ota_vars.staging = staging;
+        _ota_vars.require_erase = true;
+    }
+
+    // Snapshot the parameters, the chunks are only written with them
+    ipc_lock(IPC_LOCK_OTA_PARAMS);
+    _ota_vars.params.image_size = ipc_shared_data.ota.image_size;
+    _ota_vars.params.chunk_count = ipc_shared_data.ota.chunk_count;
+    _ota_vars.params.chunk_size = ipc_shared_data.ota.chunk_size;
+    _ota_vars.params.ack_interval = ipc_shared_data.ota.ack_interval;
+    _ota_vars.params.mode = ipc_shared_data.ota.mode;
+    _ota_vars.params.base_size = ipc_shared_data.ota.base_size;
+    memcpy(_ota_vars.params.base_hash, (const uint8_t *)ipc_shared_data.ota.base_hash, sizeof(_ota_vars.params.base_hash));
+    memcpy(_ota_vars.params.pages, (const uint8_t *)ipc_shared_data.ota.pages, sizeof(_ota_vars.params.pages));
+    memcpy(_ota_vars.params.image_hash, (const uint8_t *)ipc_shared_data.ota.image_hash, sizeof(_ota_vars.params.image_hash));
+    ipc_unlock(IPC_LOCK_OTA_PARAMS);
+
+    if (_ota_image_installed()) {
+        // Not acknowledged, the device is not part of the transfer
+        LOG_INFO("Image already installed\n");
+        _ota_end();
+        return;
+    }
+
+    // Chunks must be word aligned in flash
+    uint8_t chunk_size = _ota_vars.params.chunk_size;
+    if (chunk_size < SWRMT_OTA_CHUNK_SIZE_MIN || chunk_size > SWRMT_OTA_CHUNK_SIZE_MAX || (chunk_size & 0x03)) {
+        // Reply with the largest supported chunk size so the transfer can be started again with it
+        LOG_ERROR("Unsupported chunk size %u\n", chunk_size);
+        _ota_end();
+        _ota_send_start_ack();
+        return;
+    }
+
+    if (_ota_vars.params.chunk_count > SWARMIT_OTA_MAX_CHUNKS) {
+        // Image doesn't fit in a slot, don't acknowledge
+        LOG_ERROR("Image too large (%u chunks)\n", _ota_vars.params.chunk_count);
+        _ota_end();
+        return;
+    }
+
+    // Whatever the encoding, neither the image nor the chunks may exceed a slot
+    if (_ota_vars.params.image_size > SWARMIT_IMAGE_MAX_SIZE || _ota_vars.params.chunk_count * chunk_size > SWARMIT_IMAGE_MAX_SIZE) {
+        LOG_ERROR("Image too large (%u bytes)\n", _ota_vars.params.image_size);
+        _ota_end();
+        return;
+    }
+
+    if ((_ota_vars.params.mode & SWRMT_OTA_MODE_DELTA) && !_ota_check_base_image()) {
+        // The patch only applies to the image it was computed from
+        LOG_ERROR("Installed image doesn't match the delta base\n");
+        _ota_end();
+        return;
+    }
+
+    _ota_vars.image_addr = (staging) ? SWARMIT_STAGING_ADDRESS : SWARMIT_BASE_ADDRESS;
+    if (staging) {
+        // The previously staged image is overwritten
+        _ota_clear_info(SWARMIT_STAGING_INFO_ADDRESS);
+    } else {
+        // The installed image is modified, it is hashed again once complete
+        _ota_clear_image_info();
+    }
+
+    nvmc_writer_init(&_ota_vars.writer);
+    if (_ota_vars.params.mode == SWRMT_OTA_MODE_RAW) {
+        // Only the pages that differ from the new image are erased, in the background
+        // while chunks are received
+        _ota_erase_init();
+    } else {
+        // Pages are erased when written, only if their content changes
+        _ota_vars.require_erase = true;
+        _ota_vars.erase_pages_count = 0;
+    }
+    if (_ota_vars.params.mode & SWRMT_OTA_MODE_DELTA) {
+        // The installed image is the source of the patch
+        delta_init(&_ota_vars.delta_patcher, SWARMIT_BASE_ADDRESS, _ota_vars.image_addr, _ota_vars.params.base_size, _ota_vars.params.image_size);
+    }
+    if (_ota_vars.params.mode & SWRMT_OTA_MODE_FOUNTAIN) {
+        _ota_vars.fountain_decoder.generation = UINT32_MAX;
+    }
+    // Drop the chunks staged for a previous transfer
+    ipc_shared_data.ota.chunks_tail = ipc_shared_data.ota.chunks_head;
+    memset(_ota_vars.chunks_received, 0, sizeof(_ota_vars.chunks_received));
+    _ota_vars.chunks_received_count = 0;
+    _ota_vars.chunks_unreported = 0;
+    if (_ota_vars.params.mode == SWRMT_OTA_MODE_RAW) {
+        _ota_skip_unselected_chunks();
+    }
+    lz_init(&_ota_vars.lz_decoder);
+    _ota_vars.lz_offset = 0;
+
+    _ota_vars.transfer_active = true;
+
+    // Acknowledge right away, pages are erased before the first chunk written in them
+    _ota_send_start_ack();
+
+    // Nothing to program if no page changed
+    if (_ota_vars.chunks_received_count == _ota_vars.params.chunk_count) {
+        _ota_done();
+    }
+}
+
+void ota_process_chunks(void) {
+    while (_ota_process_next_chunk()) {}
+}
+
+void ota_report_chunks(void) {
+    if (_ota_vars.transfer_active && _ota_vars.params.ack_interval && _ota_vars.chunks_unreported) {
+        _ota_send_chunks_bitmap();
+    }
+}
+
+bool ota_erase_next_page(void) {
+    // Pages of a rejected transfer are left untouched
+    if (!_ota_vars.transfer_active) {
+        return false;
+    }
+    if (_ota_vars.erase_page < _ota_vars.erase_pages_count) {
+        _ota_erase_next_page();
+    }
+    return _ota_vars.erase_page < _ota_vars.erase_pages_count;
+}
+
+void ota_send_chunks_bitmap(void) {
+    // Devices that completed the transfer still report their full bitmap, the controller checks it
+    if (!_ota_vars.transfer_active && !_ota_vars.transfer_complete) {
+        return;
+    }
+    _ota_send_chunks_bitmap();
+}
+
+void ota_send_page_hashes(void) {
+    ipc_lock(IPC_LOCK_OTA_PARAMS);
+    uint32_t first_page = ipc_shared_data.ota.hashes_first_page;
+    uint32_t page_count = ipc_shared_data.ota.hashes_page_count;
+    uint32_t size = ipc_shared_data.ota.hashes_size;
+    ipc_unlock(IPC_LOCK_OTA_PARAMS);
+
+    if (page_count > SWRMT_OTA_PAGE_HASHES_MAX) {
+        page_count = SWRMT_OTA_PAGE_HASHES_MAX;
+    }
+    if (size > SWARMIT_IMAGE_MAX_SIZE) {
+        size = SWARMIT_IMAGE_MAX_SIZE;
+    }
+
+    size_t length = 0;
+    _ota_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_OTA_PAGE_HASHES;
+    swrmt_ota_page_hashes_t *notification = (swrmt_ota_page_hashes_t *)&_ota_vars.notification_buffer[length];
+    notification->first_page = first_page;
+    notification->length = 0;
+    uint8_t hash[SWRMT_OTA_SHA256_LENGTH];
+    for (uint32_t page = first_page; page < first_page + page_count && page * FLASH_PAGE_SIZE < size; page++) {
+        uint32_t page_size = size - page * FLASH_PAGE_SIZE;
+        if (page_size > FLASH_PAGE_SIZE) {
+            page_size = FLASH_PAGE_SIZE;
+        }
+        crypto_sha256_init();
+        crypto_sha256_update((const uint8_t *)(SWARMIT_BASE_ADDRESS + page * FLASH_PAGE_SIZE), page_size);
+        crypto_sha256(hash);
+        memcpy(&notification->hashes[notification->length], hash, SWRMT_OTA_PAGE_HASH_LENGTH);
+        notification->length += SWRMT_OTA_PAGE_HASH_LENGTH;
+    }
+    length += sizeof(uint8_t) + sizeof(uint8_t) + notification->length;
+    mari_node_tx(_ota_vars.notification_buffer, length);
+}
+
+void ota_irq_init(void) {
+    NVIC_SetPriority(OTA_IRQn, OTA_IRQ_PRIORITY);
+    NVIC_ClearPendingIRQ(OTA_IRQn);
+    NVIC_EnableIRQ(OTA_IRQn);
+}
+
+void ota_request(ota_request_t request) {
+    switch (request) {
+        case OTA_REQUEST_START:
+            _ota_vars.start_requested = true;
+            break;
+        case OTA_REQUEST_CHUNKS:
+            // Chunks are read from the queue, only the background erase is requested
+            _ota_vars.erase_requested = true;
+            break;
+        case OTA_REQUEST_BITMAP:
+            _ota_vars.bitmap_requested = true;
+            break;
+        case OTA_REQUEST_PAGE_HASHES:
+            _ota_vars.page_hashes_requested = true;
+            break;
+        default:
+            return;
+    }
+    NVIC_SetPendingIRQ(OTA_IRQn);
+}
+
+//=========================== interrupt handlers ===============================
+
+void EGU5_IRQHandler(void) {
+    // Requests are cleared before being handled, one received meanwhile is merged with it
+    if (_ota_vars.start_requested) {
+        _ota_vars.start_requested = false;
+        ota_start(true);
+    } else if (_ota_vars.page_hashes_requested) {
+        _ota_vars.page_hashes_requested = false;
+        ota_send_page_hashes();
+    } else if (_ota_vars.bitmap_requested) {
+        _ota_vars.bitmap_requested = false;
+        ota_send_chunks_bitmap();
+    } else if (!_ota_process_next_chunk() && _ota_vars.erase_requested) {
+        // Erase ahead of the next chunks, one page per chunk event like in the bootloader main loop
+        _ota_vars.erase_requested = false;
+        ota_erase_next_page();
+    }
+
+    // Only one step is done per interrupt, pending interrupts of higher priority run between them
+    if (_ota_work_pending()) {
+        NVIC_SetPendingIRQ(OTA_IRQn);
+    }
+}
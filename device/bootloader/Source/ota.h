@@ -0,0 +1,118 @@
+#ifndef __OTA_H
+#define __OTA_H
+
+/**
+ * @defgroup    bootloader_ota  Over the air programming
+ * @ingroup     bootloader
+ * @brief       Write the OTA chunks staged by the network core to flash
+ *
+ * Non secure flash holds two image slots. User images are linked at
+ * SWARMIT_BASE_ADDRESS and run from there, this slot is programmed directly
+ * while the bootloader is ready. While the user image runs, the image is
+ * received in the staging slot instead and the last flash page records it
+ * once complete. The changed pages of a staged image are copied to the
+ * execution slot at the next boot.
+ *
+ * The SHA256 of the installed image is recorded once it is completely
+ * programmed, devices don't acknowledge the transfer of an image they already
+ * run.
+ *
+ * @{
+ * @file
+ * @author Anonymous Author <anon@anonymous.com>
+ * @copyright Anonymized Copyright, 2025
+ * @}
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "nvmc.h"
+#include "protocol.h"
+
+//=========================== defines ==========================================
+
+#define SWARMIT_BASE_ADDRESS            (0x10000)   ///< Execution slot, user images are linked at this address
+#define SWARMIT_FLASH_END               (0x100000)
+#define SWARMIT_STAGING_INFO_ADDRESS    (SWARMIT_FLASH_END - FLASH_PAGE_SIZE)   ///< Page recording the image waiting in the staging slot
+#define SWARMIT_IMAGE_MAX_SIZE          (((SWARMIT_STAGING_INFO_ADDRESS - SWARMIT_BASE_ADDRESS) / 2) & ~(FLASH_PAGE_SIZE - 1))
+#define SWARMIT_STAGING_ADDRESS         (SWARMIT_BASE_ADDRESS + SWARMIT_IMAGE_MAX_SIZE)  ///< Staging slot, receives images while the user image runs
+#define SWARMIT_IMAGE_INFO_ADDRESS      (SWARMIT_STAGING_ADDRESS + SWARMIT_IMAGE_MAX_SIZE)  ///< Page recording the hash of the installed image
+#define SWARMIT_OTA_MAX_CHUNKS          (SWARMIT_IMAGE_MAX_SIZE / SWRMT_OTA_CHUNK_SIZE_MIN)
+
+/// Requests of the network core, received while the user image runs
+typedef enum {
+    OTA_REQUEST_START,          ///< Start a transfer to the staging slot
+    OTA_REQUEST_CHUNKS,         ///< Write the queued chunks
+    OTA_REQUEST_BITMAP,         ///< Notify the bitmap of written chunks
+    OTA_REQUEST_PAGE_HASHES,    ///< Notify the hashes of the installed image pages
+} ota_request_t;
+
+//=========================== prototypes =======================================
+
+/**
+ * @brief Install the image staged while the previous user image was running, if any, and load the installed image hash
+ *
+ * Must be called at boot, before the user image is started. Copying is
+ * resumed after a reset since the staging record is only cleared once all
+ * pages are copied.
+ */
+void ota_init(void);
+
+/**
+ * @brief Start a transfer with the parameters given by the network core
+ *
+ * @param[in] staging   true to receive the image in the staging slot because the user image is running
+ */
+void ota_start(bool staging);
+
+/**
+ * @brief Write the chunks staged by the network core to flash, in the order they were received
+ *
+ * Chunks are dropped while no transfer is in progress.
+ */
+void ota_process_chunks(void);
+
+/**
+ * @brief Notify the bitmap of the chunks written to flash
+ *
+ * Nothing is sent if the last start request was not accepted.
+ */
+void ota_send_chunks_bitmap(void);
+
+/**
+ * @brief Notify the chunks written since the last notification, when acknowledgments are cumulative
+ */
+void ota_report_chunks(void);
+
+/**
+ * @brief Notify the hashes of the installed image pages requested by the network core
+ */
+void ota_send_page_hashes(void);
+
+/**
+ * @brief Erase the next page of the image that will be written, ahead of its chunks
+ *
+ * @return true if pages are left to erase
+ */
+bool ota_erase_next_page(void);
+
+/**
+ * @brief Enable the secure interrupt handling the OTA requests while the user image runs
+ *
+ * It has the lowest priority and does one step per interrupt: a start
+ * request, a chunk, a page erase or a notification. Flash is still erased and
+ * written from it, which stalls the CPU, user image interrupts included.
+ */
+void ota_irq_init(void);
+
+/**
+ * @brief Defer a request of the network core to the OTA interrupt
+ *
+ * Called from the user image IPC interrupt, which must return quickly.
+ *
+ * @param[in] request   request received on the corresponding IPC channel
+ */
+void ota_request(ota_request_t request);
+
+#endif
@@ -24,14 +24,43 @@
 #define GATEWAY_ADDRESS   0x0000000000000000UL  ///< Gateway address
 
 #define SWRMT_PREAMBLE_LENGTH       (8U)
-#define SWRMT_OTA_CHUNK_SIZE        (128U)
+#define SWRMT_OTA_CHUNK_SIZE_MIN    (128U)  ///< Smallest chunk size accepted, bounds the number of chunks of an image
+#define SWRMT_OTA_CHUNK_SIZE_MAX    (220U)  ///< Largest chunk fitting in a Mari payload with the chunk request header, multiple of 4
+#define SWRMT_OTA_SHA256_LENGTH     (32U)
+#define SWRMT_OTA_PAGES_BITMAP_SIZE (30U)   ///< Bitmap covering the 240 flash pages of the non secure image region
+#define SWRMT_OTA_PAGE_HASH_LENGTH  (8U)    ///< Length of the truncated SHA256 of a flash page
+#define SWRMT_IMAGE_HASH_LENGTH     (8U)    ///< Length of the truncated SHA256 identifying a user image
+#define SWRMT_OTA_PAGE_HASHES_MAX   (28U)   ///< Max page hashes per notification
+#define SWRMT_LOG_RECORDS_MAX_SIZE  (220U)  ///< Max binary log records bytes per notification
+#define SWRMT_LOG_EVENTS_MAX_SIZE   (220U)  ///< Max log entries bytes per notification
+#define SWRMT_OTA_BITMAP_MAX_SIZE   (188U)  ///< Max bitmap bytes per notification, covers 1504 chunks
+#define SWRMT_OTA_FOUNTAIN_GENERATION_SIZE (16U)  ///< Number of chunks combined in fountain coded symbols
+#define SWRMT_OTA_LZ_BLOCK_MAX_SIZE (1024U) ///< Max decompressed size of an LZ compressed chunk
 
 typedef struct __attribute__((packed)) {
-    uint32_t index;                             ///< Index of the chunk
+    uint32_t index;                             ///< Index of the chunk, generation (high 16 bits) and coefficients (low 16 bits) of fountain symbols
     uint8_t  chunk_size;                        ///< Size of the chunk
-    uint8_t  chunk[SWRMT_OTA_CHUNK_SIZE];       ///< Bytes array of the firmware chunk
+    uint8_t  sha[8];                            ///< First bytes of the SHA256 of the chunk
+    uint8_t  chunk[SWRMT_OTA_CHUNK_SIZE_MAX];   ///< Bytes array of the firmware chunk
 } swrmt_ota_chunk_pkt_t;
 
+typedef struct __attribute__((packed)) {
+    uint8_t  chunk_size_max;                    ///< Largest chunk size supported, currently always SWRMT_OTA_CHUNK_SIZE_MAX
+} swrmt_ota_start_ack_t;
+
+///< Cumulative acknowledgment: all chunks below base are received, bit i of bitmap is chunk base + i
+typedef struct __attribute__((packed)) {
+    uint32_t base;                              ///< Index of the chunk corresponding to the first bit
+    uint8_t  count;                             ///< Number of bytes in the bitmap
+    uint8_t  bitmap[SWRMT_OTA_BITMAP_MAX_SIZE]; ///< Bitmap of received chunks
+} swrmt_ota_chunk_bitmap_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t  first_page;                        ///< Index of the first page, relative to the image start
+    uint8_t  length;                            ///< Number of bytes in hashes
+    uint8_t  hashes[SWRMT_OTA_PAGE_HASHES_MAX * SWRMT_OTA_PAGE_HASH_LENGTH];    ///< Truncated SHA256 of each page
+} swrmt_ota_page_hashes_t;
+
 typedef enum {
     SWRMT_APPLICATION_READY = 0,
     SWRMT_APPLICATION_RUNNING,
@@ -40,6 +69,13 @@ typedef enum {
     SWRMT_APPLICATION_PROGRAMMING,
 } swrmt_application_status_t;
 
+typedef enum {
+    SWRMT_OTA_MODE_RAW = 0,                     ///< Chunks hold raw image bytes
+    SWRMT_OTA_MODE_LZ = 1 << 0,                 ///< Chunks hold LZ compressed blocks, decompressed in order
+    SWRMT_OTA_MODE_DELTA = 1 << 1,              ///< Chunks hold a delta patch of the installed image, can be combined with LZ
+    SWRMT_OTA_MODE_FOUNTAIN = 1 << 2,           ///< Chunks are fountain coded symbols of the raw image, not acknowledged
+} swrmt_ota_mode_t;
+
 typedef enum {
     SWRMT_REQUEST_STATUS = 0x80,
     SWRMT_REQUEST_START = 0x81,
@@ -47,6 +83,9 @@ typedef enum {
     SWRMT_REQUEST_RESET = 0x83,
     SWRMT_REQUEST_OTA_START = 0x84,
     SWRMT_REQUEST_OTA_CHUNK = 0x85,
+    SWRMT_REQUEST_OTA_STATUS = 0x86,
+    SWRMT_REQUEST_OTA_PAGE_HASHES = 0x87,
+    SWRMT_REQUEST_STATUS_POLICY = 0x88,
 } swrmt_request_type_t;
 
 typedef enum {
@@ -57,6 +96,9 @@ typedef enum {
     SWRMT_NOTIFICATION_OTA_CHUNK_ACK = 0x94,
     SWRMT_NOTIFICATION_GPIO_EVENT = 0x95,
     SWRMT_NOTIFICATION_LOG_EVENT = 0x96,
+    SWRMT_NOTIFICATION_OTA_CHUNK_BITMAP = 0x97,
+    SWRMT_NOTIFICATION_OTA_PAGE_HASHES = 0x98,
+    SWRMT_NOTIFICATION_LOG_RECORDS = 0x99,
 } swrmt_notification_type_t;
 
 /// Application type
@@ -11,6 +11,7 @@
 #include <nrf.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "ipc.h"
 #include "rng.h"
@@ -22,10 +23,41 @@ extern volatile __attribute__((section(".shared_data"))) ipc_shared_data_t ipc_s
 //=========================== public ===========================================
 
 void rng_init(void) {
-    ipc_network_call(IPC_RNG_INIT_REQ);
+    // Bytes left in the pool before a reset of the application core are not trusted
+    ipc_shared_data.entropy.tail = ipc_shared_data.entropy.head;
+    // The network core fills the pool once the RNG is initialized
+    ipc_network_call(IPC_RNG_INIT_REQ, NULL, 0);
 }
 
 void rng_read(uint8_t *value) {
-    ipc_network_call(IPC_RNG_READ_REQ);
-    *value = ipc_shared_data.rng.value;
+    // Also called from interrupts, where commands can't be posted, wait for the network core to refill the pool
+    while (rng_read_pool(value, 1) == 0) {
+        NRF_IPC_S->TASKS_SEND[IPC_CHAN_ENTROPY] = 1;
+        while (ipc_shared_data.entropy.head == ipc_shared_data.entropy.tail) {}
+    }
+}
+
+size_t rng_read_pool(uint8_t *values, size_t length) {
+    // The pool is shared by the secure and non secure callers, take the bytes atomically
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint8_t tail = ipc_shared_data.entropy.tail;
+    uint8_t available = ipc_shared_data.entropy.head - tail;
+    if (length > available) {
+        length = available;
+    }
+    // Read the bytes after the head
+    __DMB();
+    for (size_t i = 0; i < length; i++) {
+        values[i] = ipc_shared_data.entropy.data[tail++ & (IPC_ENTROPY_POOL_SIZE - 1)];
+    }
+    // Release the bytes before the new tail
+    __DMB();
+    ipc_shared_data.entropy.tail = tail;
+    __set_PRIMASK(primask);
+
+    if (length) {
+        NRF_IPC_S->TASKS_SEND[IPC_CHAN_ENTROPY] = 1;
+    }
+    return length;
 }
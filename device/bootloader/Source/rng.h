@@ -14,6 +14,7 @@
  */
 
 #include <stdint.h>
+#include <stdlib.h>
 
 //=========================== defines ==========================================
 
@@ -27,8 +28,23 @@ void rng_init(void);
 /**
  * @brief Read a random value (8 bits)
  *
+ * Waits for the network core to refill the pool when it is empty, must be
+ * called after rng_init. Can be called from interrupts.
+ *
  * @param[out] value address of the output value
  */
 void rng_read(uint8_t *value);
 
+/**
+ * @brief Take random bytes from the pool refilled by the network core, never blocks
+ *
+ * Must be called after rng_init.
+ *
+ * @param[out] values   address of the output bytes
+ * @param[in]  length   number of bytes requested
+ *
+ * @return number of bytes read, less than length when the pool runs out
+ */
+size_t rng_read_pool(uint8_t *values, size_t length);
+
 #endif
@@ -20,14 +20,22 @@
 
 #define IPC_IRQ_PRIORITY (1)
 
+#define IPC_OTA_CHUNK_SLOTS (4)  ///< Number of OTA chunk staging slots, must be a power of 2
+#define IPC_RADIO_PDU_SLOTS (4)  ///< Number of radio PDU slots in each direction, must be a power of 2
+#define IPC_CMD_SLOTS       (8)  ///< Number of commands in the mailbox, must be a power of 2
+#define IPC_CMD_DATA_SIZE   (32) ///< Maximum size of the arguments and of the result of a command
+#define IPC_ENTROPY_POOL_SIZE (64)  ///< Number of random bytes kept ready by the network core, must be a power of 2
+#define IPC_LOG_RING_SIZE (512)  ///< Size of the log entries ring in bytes, must be a power of 2
+#define IPC_LOG_RECORD_SLOTS (16)  ///< Number of binary log records waiting to be sent, must be a power of 2
+#define IPC_LOG_RECORD_ARGS_MAX (4)  ///< Maximum number of 32-bit arguments of a binary log record
+
 #define IPC_LOG_SIZE     (128)
 
 typedef enum {
     IPC_REQ_NONE,        ///< Sorry, but nothing
     IPC_MARI_INIT_REQ,
-    IPC_MARI_NODE_TX_REQ,
     IPC_RNG_INIT_REQ,                ///< Request for rng init
-    IPC_RNG_READ_REQ,                ///< Request for rng read
+    IPC_RNG_READ_REQ,                ///< Request for rng read, the argument is the number of bytes to read
 } ipc_req_t;
 
 typedef enum {
@@ -39,11 +47,44 @@ typedef enum {
     IPC_CHAN_LOG_EVENT          = 5,    ///< Channel used for logging events
     IPC_CHAN_OTA_START          = 6,    ///< Channel used for starting an OTA process
     IPC_CHAN_OTA_CHUNK          = 7,    ///< Channel used for writing a non secure image chunk
+    IPC_CHAN_OTA_STATUS         = 8,    ///< Channel used for requesting the bitmap of received chunks
+    IPC_CHAN_OTA_PAGE_HASHES    = 9,    ///< Channel used for requesting the hashes of image pages
+    IPC_CHAN_RADIO_TX           = 10,   ///< Channel used for radio TX events, PDUs are waiting in the TX ring
+    IPC_CHAN_ENTROPY            = 11,   ///< Channel used for requesting a refill of the entropy pool
+    IPC_CHAN_LOCK_RELEASE       = 12,   ///< Channel used for waking up the other core waiting for a lock
+    IPC_CHAN_LOG_RECORD         = 13,   ///< Channel used for binary log events, records are waiting in the log ring
 } ipc_channels_t;
 
-typedef struct {
-    uint8_t value;  ///< Byte containing the random value read
-} ipc_rng_data_t;
+/// Locks shared by both cores, each uses the application domain MUTEX of the same index
+typedef enum {
+    IPC_LOCK_OTA_PARAMS = 0,    ///< Protects the transfer parameters (image_size to image_hash) and the page hashes request (hashes_first_page to hashes_size) of ipc_ota_data_t
+    IPC_LOCK_COUNT,
+} ipc_lock_t;
+
+typedef struct __attribute__((packed)) {
+    bool     waiting;       ///< The core sleeps until the other core releases the lock
+    uint32_t acquired;      ///< Number of times the lock was taken
+    uint32_t contended;     ///< Number of times the lock was held by the other core when requested
+    uint32_t wakeups;       ///< Number of wake ups while waiting for the lock
+} ipc_lock_state_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t req;                        ///< Request, one of ipc_req_t
+    uint8_t length;                     ///< Length of the arguments, replaced by the length of the result once executed
+    uint8_t data[IPC_CMD_DATA_SIZE];    ///< Arguments, replaced by the result once executed
+} ipc_cmd_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t     head;                   ///< Free running index of the next command posted by the application core
+    uint8_t     tail;                   ///< Free running index of the next command executed by the network core, commands before it are complete
+    ipc_cmd_t   cmds[IPC_CMD_SLOTS];    ///< Commands waiting to be executed by the network core
+} ipc_mailbox_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t head;                           ///< Free running index of the next byte written by the network core
+    uint8_t tail;                           ///< Free running index of the next byte read by the application core
+    uint8_t data[IPC_ENTROPY_POOL_SIZE];    ///< Random bytes
+} ipc_entropy_pool_t;
 
 typedef struct __attribute__((packed)) {
     uint8_t length;             ///< Length of the pdu in bytes
@@ -51,17 +92,65 @@ typedef struct __attribute__((packed)) {
 } ipc_radio_pdu_t;
 
 typedef struct __attribute__((packed)) {
-    uint8_t length;
-    uint8_t data[INT8_MAX];
+    uint8_t         head;       ///< Free running index of the next slot written by the producer core
+    uint8_t         tail;       ///< Free running index of the next slot read by the consumer core
+    uint32_t        dropped;    ///< Number of PDUs dropped because the ring was full, only written by the producer core
+    ipc_radio_pdu_t pdus[IPC_RADIO_PDU_SLOTS];  ///< PDUs waiting to be read by the consumer core
+} ipc_radio_ring_t;
+
+typedef struct __attribute__((packed)) {
+    bool     enabled;               ///< Only the packet types set in the bitmap are delivered, all packets otherwise
+    uint8_t  types[32];             ///< Bitmap of the packet types delivered, indexed by the first byte of the packet
+    uint8_t  batch_size;            ///< Number of queued packets raising the RX event, 0 or 1 to raise it for every packet
+    uint32_t batch_delay_us;        ///< Maximum delay of the RX event after a packet is queued, when batching
+    uint32_t filtered;              ///< Number of packets dropped by the filter, only written by the network core
+} ipc_rx_filter_t;
+
+typedef struct __attribute__((packed)) {
+    uint16_t head;                      ///< Free running index of the next byte written by the application core
+    uint16_t tail;                      ///< Free running index of the next byte read by the network core
+    uint32_t dropped;                   ///< Number of entries dropped because the ring was full, or of resyncs after a corrupt entry
+    uint8_t  data[IPC_LOG_RING_SIZE];   ///< Entries waiting to be sent, each is a length byte followed by the logged bytes
 } ipc_log_data_t;
 
 typedef struct __attribute__((packed)) {
+    uint32_t fmt;                               ///< Address of the format string in the user image, resolved on the host from the image ELF file
+    uint8_t  count;                             ///< Number of arguments
+    uint32_t args[IPC_LOG_RECORD_ARGS_MAX];     ///< Arguments, formatted on the host
+} ipc_log_record_t;
+
+typedef struct __attribute__((packed)) {
+    uint8_t          head;      ///< Free running index of the next record written by the application core
+    uint8_t          tail;      ///< Free running index of the next record sent by the network core
+    uint32_t         dropped;   ///< Number of records dropped because the ring was full or their count was invalid
+    ipc_log_record_t records[IPC_LOG_RECORD_SLOTS]; ///< Records waiting to be batched in a radio frame
+} ipc_log_ring_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t index;                 ///< Index of the chunk in the image
+    uint32_t size;                  ///< Size of the chunk in bytes
+    uint8_t  data[SWRMT_OTA_CHUNK_SIZE_MAX];   ///< Chunk bytes
+} ipc_ota_chunk_t;
+
+typedef struct __attribute__((packed)) {
+    // Written by the network core under IPC_LOCK_OTA_PARAMS
     uint32_t image_size;
     uint32_t chunk_count;
-    uint32_t chunk_index;
-    uint32_t chunk_size;
-    int32_t  last_chunk_acked;
-    uint8_t chunk[INT8_MAX + 1];
+    uint8_t  chunk_size;
+    uint8_t  ack_interval;
+    uint8_t  mode;
+    uint32_t base_size;
+    uint8_t  base_hash[8];
+    uint8_t  pages[SWRMT_OTA_PAGES_BITMAP_SIZE];
+    uint8_t  image_hash[SWRMT_IMAGE_HASH_LENGTH];
+    // Written by the network core under IPC_LOCK_OTA_PARAMS
+    uint8_t  hashes_first_page;
+    uint8_t  hashes_page_count;
+    uint32_t hashes_size;
+    // Lock free
+    uint8_t  chunks_head;           ///< Free running index of the next slot written by the network core
+    uint8_t  chunks_tail;           ///< Free running index of the next slot written to flash by the application core
+    ipc_ota_chunk_t chunks[IPC_OTA_CHUNK_SLOTS];    ///< Ring of chunks verified by the network core, waiting to be written to flash
 } ipc_ota_data_t;
 
 /// DotBot protocol LH2 computed location
@@ -72,32 +161,59 @@ typedef struct __attribute__((packed)) {
 
 typedef struct __attribute__((packed)) {
     bool                    net_ready;          ///< Network core is ready
-    bool                    net_ack;            ///< Network core acked the latest request
-    ipc_req_t               req;                ///< IPC network request
     uint8_t                 status;             ///< Experiment status
     uint16_t                battery_level;      ///< Battery level in mV
     swrmt_device_type_t     device_type;        ///< Device type
-    ipc_log_data_t          log;                ///< Log data
-    ipc_rng_data_t          rng;                ///< Rng shared data
+    uint8_t                 image_hash[SWRMT_IMAGE_HASH_LENGTH];    ///< Truncated SHA256 of the installed user image, zeros when unknown
+    ipc_log_data_t          log;                ///< Log entries of the user image
+    ipc_mailbox_t           mailbox;            ///< Commands posted to the network core
+    ipc_entropy_pool_t      entropy;            ///< Random bytes refilled by the network core in the background
+    ipc_lock_state_t        app_locks[IPC_LOCK_COUNT];  ///< Locks state of the application core, only written by it
+    ipc_lock_state_t        net_locks[IPC_LOCK_COUNT];  ///< Locks state of the network core, only written by it
     ipc_ota_data_t          ota;                ///< OTA data
     position_2d_t           target_position;    ///< LH2 target location
     position_2d_t           current_position;   ///< Current 2D position
-    ipc_radio_pdu_t         tx_pdu;             ///< TX pdu
-    ipc_radio_pdu_t         rx_pdu;             ///< RX pdu
+    ipc_radio_ring_t        tx_ring;            ///< PDUs sent by the application core
+    ipc_radio_ring_t        rx_ring;            ///< PDUs received for the application core, read in place by the user callback
+    ipc_rx_filter_t         rx_filter;          ///< Packets delivered to the user image and coalescing of the RX events, set by the application core
+    ipc_log_ring_t          log_records;        ///< Binary log records of the user image
 } ipc_shared_data_t;
 
+extern volatile __attribute__((section(".shared_data"))) ipc_shared_data_t ipc_shared_data;
+
 /**
- * @brief Lock the mutex, blocks until the mutex is locked
+ * @brief Take a lock shared with the application core, sleeps until the application core releases it
+ *
+ * @param[in] lock  lock to take
  */
-static inline void mutex_lock(void) {
-    while (NRF_APPMUTEX_NS->MUTEX[0]) {}
+static inline void ipc_lock(ipc_lock_t lock) {
+    volatile ipc_lock_state_t *state = &ipc_shared_data.net_locks[lock];
+    // Reading the mutex takes it if it is free
+    if (NRF_APPMUTEX_NS->MUTEX[lock]) {
+        state->contended++;
+        state->waiting = true;
+        // The flag must be visible before the mutex is read again, or the release event could be missed
+        __DMB();
+        while (NRF_APPMUTEX_NS->MUTEX[lock]) {
+            __WFE();
+            state->wakeups++;
+        }
+        state->waiting = false;
+    }
+    state->acquired++;
 }
 
 /**
- * @brief Unlock the mutex, has no effect if the mutex is already unlocked
+ * @brief Release a lock, wakes up the application core if it is waiting for it
+ *
+ * @param[in] lock  lock to release
  */
-static inline void mutex_unlock(void) {
-    NRF_APPMUTEX_NS->MUTEX[0] = 0;
+static inline void ipc_unlock(ipc_lock_t lock) {
+    NRF_APPMUTEX_NS->MUTEX[lock] = 0;
+    __DMB();
+    if (ipc_shared_data.app_locks[lock].waiting) {
+        NRF_IPC_NS->TASKS_SEND[IPC_CHAN_LOCK_RELEASE] = 1;
+    }
 }
 
 #endif
@@ -0,0 +1,72 @@
+/**
+ * @file
+ * @ingroup swarmit_log
+ *
+ * @brief  Implementation of the deferred binary logging.
+ *
+ * @author Anonymous Author <anon@anonymous.com>
+ *
+ * @copyright Anonymized Copyright, 2025
+ */
+#include <nrf.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+//=========================== defines ==========================================
+
+#define LOG_BUFFER_MASK         (LOG_BUFFER_SIZE - 1)
+#define LOG_HEADER_SIZE         (2U)    ///< Words before the arguments: format address, argument count
+
+typedef struct {
+    uint32_t            buffer[LOG_BUFFER_SIZE];    ///< Messages, each as a format address, an argument count and the arguments
+    volatile uint32_t   head;                       ///< Free running index of the next word written
+    volatile uint32_t   tail;                       ///< Free running index of the next word printed
+    uint32_t            dropped;                    ///< Number of messages dropped because the buffer was full
+} log_vars_t;
+
+//=========================== variables ========================================
+
+static log_vars_t _log_vars = { 0 };
+
+//=========================== public ===========================================
+
+void log_write(const char *fmt, const uint32_t *args, size_t count) {
+    // Messages are logged from interrupts too
+    uint32_t primask = __get_PRIMASK();
+    __disable_irq();
+    uint32_t head = _log_vars.head;
+    if (LOG_BUFFER_SIZE - (head - _log_vars.tail) < LOG_HEADER_SIZE + count) {
+        _log_vars.dropped++;
+        __set_PRIMASK(primask);
+        return;
+    }
+    _log_vars.buffer[head++ & LOG_BUFFER_MASK] = (uint32_t)fmt;
+    _log_vars.buffer[head++ & LOG_BUFFER_MASK] = count;
+    for (size_t i = 0; i < count; i++) {
+        _log_vars.buffer[head++ & LOG_BUFFER_MASK] = args[i];
+    }
+    _log_vars.head = head;
+    __set_PRIMASK(primask);
+}
+
+void log_flush(void) {
+    uint32_t tail = _log_vars.tail;
+    while (tail != _log_vars.head) {
+        const char *fmt = (const char *)_log_vars.buffer[tail++ & LOG_BUFFER_MASK];
+        uint32_t count = _log_vars.buffer[tail++ & LOG_BUFFER_MASK];
+        uint32_t args[LOG_ARGS_MAX] = { 0 };
+        for (uint32_t i = 0; i < count && i < LOG_ARGS_MAX; i++) {
+            args[i] = _log_vars.buffer[tail++ & LOG_BUFFER_MASK];
+        }
+        // Release the words before printing, printing is slow
+        _log_vars.tail = tail;
+        printf(fmt, args[0], args[1], args[2], args[3]);
+    }
+}
+
+uint32_t log_dropped(void) {
+    return _log_vars.dropped;
+}
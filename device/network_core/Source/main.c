@@ -9,11 +9,13 @@
  */
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <nrf.h>
 // Include BSP headers
 #include "ipc.h"
+#include "log.h"
 #include "protocol.h"
 #include "rng.h"
 #include "sha256.h"
@@ -26,6 +28,17 @@
 #include "mari.h"
 
 #define NETCORE_MAIN_TIMER                  (0)
+#define NETCORE_STATUS_TIMER_CHANNEL        (0)
+#define NETCORE_RX_TIMER_CHANNEL            (1)
+#define NETCORE_LOG_TIMER_CHANNEL           (2)
+#define NETCORE_LOG_FLUSH_DELAY_US          (100000UL)  ///< Maximum delay of a log entry before its notification is sent
+#define NETCORE_LOG_ENTRY_MAX_SIZE          (SWRMT_LOG_EVENTS_MAX_SIZE - 6)  ///< Largest entry fitting in a notification after its timestamp delta and length
+#define NETCORE_ENTROPY_REFILL_MAX          (16)    ///< Maximum number of random bytes generated per loop iteration
+#define NETCORE_FRAME_SLOTS                 (8)     ///< Number of received requests waiting for the main loop, must be a power of 2
+#define NETCORE_STATUS_CHECK_PERIOD_MS      (100U)  ///< Period of the status policy evaluation
+#define NETCORE_STATUS_HEARTBEAT_MS_DEFAULT (2000U) ///< Default maximum interval between two status notifications
+#define NETCORE_STATUS_BATTERY_DELTA_DEFAULT    (50U)       ///< Default battery level change (mV) sending a status notification
+#define NETCORE_STATUS_POSITION_DELTA_DEFAULT   (50000U)    ///< Default position change sending a status notification, position units are 1e-6
 
 // Important: select a Network ID according to the specific deployment you are making,
 // see the registry at https://crystalfree.atlassian.net/wiki/spaces/Mari/pages/3324903426/Registry+of+Mari+Network+IDs
@@ -34,21 +47,42 @@
 //=========================== variables =========================================
 
 typedef struct {
-    bool        req_received;
+    uint8_t     length;
+    uint8_t     data[UINT8_MAX];
+} swrmt_frame_t;
+
+typedef struct {
+    swrmt_frame_t       frames[NETCORE_FRAME_SLOTS];    ///< Requests and metrics probes received, handled in order by the main loop
+    volatile uint8_t    frames_head;                    ///< Free running index of the next slot written by the radio callback
+    volatile uint8_t    frames_tail;                    ///< Free running index of the next slot handled by the main loop
+    uint32_t    frames_dropped;                         ///< Number of frames dropped because the queue was full
     bool        data_received;
-    bool        send_status;
-    uint8_t     req_buffer[255];
+    bool        check_status;
+    swrmt_status_policy_pkt_t   status_policy;          ///< When status notifications are sent, set by the controller
+    uint32_t    status_elapsed_ms;                      ///< Time since the last status notification
+    uint8_t     status_last;                            ///< Values in the last status notification, compared with the policy deltas
+    uint16_t    battery_last;
+    position_2d_t   position_last;
     uint8_t     notification_buffer[255];
-    ipc_req_t   ipc_req;
+    bool        cmd_received;
     bool        ipc_log_received;
+    bool        log_records_received;
+    bool        log_flush_requested;
+    uint8_t     log_events[SWRMT_LOG_EVENTS_MAX_SIZE];  ///< Log entries waiting for the next notification, each prefixed with its timestamp delta
+    size_t      log_events_length;
+    uint32_t    log_events_timestamp;                   ///< Timestamp of the first entry of the notification
+    uint32_t    log_last_timestamp;                     ///< Timestamp of the last entry, the next delta is relative to it
+    bool        tx_requested;
+    bool        rng_ready;
+    bool        entropy_requested;
+    uint8_t     rx_unnotified;
     uint8_t     gpio_event_idx;
+    bool        ota_staging;                            ///< A start request flagged for staging was accepted while the user image runs
     uint8_t     expected_hash[SWRMT_OTA_SHA256_LENGTH];
     uint8_t     computed_hash[SWRMT_OTA_SHA256_LENGTH];
     uint64_t    device_id;
-    int32_t     last_chunk_acked;
     uint32_t    metrics_rx_counter;
     uint32_t    metrics_tx_counter;
-    bool        metrics_received;
 } swrmt_app_data_t;
 
 static swrmt_app_data_t _app_vars = { 0 };
@@ -58,17 +92,30 @@ volatile __attribute__((section(".shared_data"))) ipc_shared_data_t ipc_shared_d
 
 //=========================== functions =========================================
 
+static void _rx_batch_timeout(void) {
+    // An event already sent for this batch makes this one spurious, the application core then finds no packet
+    _app_vars.data_received = true;
+}
+
 static void _handle_packet(uint64_t dst_address, uint8_t *packet, uint8_t length) {
-    memcpy(_app_vars.req_buffer, packet, length);
-    uint8_t *ptr = _app_vars.req_buffer;
-    uint8_t packet_type = (uint8_t)*ptr++;
-    if ((packet_type >= SWRMT_REQUEST_STATUS) && (packet_type <= SWRMT_REQUEST_OTA_CHUNK)) {
-        _app_vars.req_received = true;
+    if (length == 0) {
         return;
     }
 
-    if (length == sizeof(mr_metrics_payload_t) && packet_type == MARI_PAYLOAD_TYPE_METRICS_PROBE) {
-        _app_vars.metrics_received = true;
+    // Only the packets handled by the network core are queued for the main loop
+    uint8_t packet_type = packet[0];
+    if (((packet_type >= SWRMT_REQUEST_STATUS) && (packet_type <= SWRMT_REQUEST_STATUS_POLICY)) ||
+        (length == sizeof(mr_metrics_payload_t) && packet_type == MARI_PAYLOAD_TYPE_METRICS_PROBE)) {
+        uint8_t head = _app_vars.frames_head;
+        if ((uint8_t)(head - _app_vars.frames_tail) >= NETCORE_FRAME_SLOTS) {
+            // Not acknowledged, the controller sends the request again
+            _app_vars.frames_dropped++;
+            return;
+        }
+        swrmt_frame_t *frame = &_app_vars.frames[head & (NETCORE_FRAME_SLOTS - 1)];
+        frame->length = length;
+        memcpy(frame->data, packet, length);
+        _app_vars.frames_head = head + 1;
         return;
     }
 
@@ -81,9 +128,33 @@ static void _handle_packet(uint64_t dst_address, uint8_t *packet, uint8_t length
         return;
     }
 
-    ipc_shared_data.rx_pdu.length = length;
-    memcpy((uint8_t *)ipc_shared_data.rx_pdu.buffer, packet, length);
-    _app_vars.data_received = true;
+    // Packets the user image didn't ask for are dropped without waking it up
+    if (ipc_shared_data.rx_filter.enabled && !(ipc_shared_data.rx_filter.types[packet_type >> 3] & (1 << (packet_type & 0x07)))) {
+        ipc_shared_data.rx_filter.filtered++;
+        return;
+    }
+
+    // Queue the packet, this is its only copy: the user callback reads the slot in place
+    // and the application core releases it once the callback returns
+    uint8_t head = ipc_shared_data.rx_ring.head;
+    if ((uint8_t)(head - ipc_shared_data.rx_ring.tail) >= IPC_RADIO_PDU_SLOTS) {
+        ipc_shared_data.rx_ring.dropped++;
+        return;
+    }
+    volatile ipc_radio_pdu_t *pdu = &ipc_shared_data.rx_ring.pdus[head & (IPC_RADIO_PDU_SLOTS - 1)];
+    pdu->length = length;
+    memcpy((uint8_t *)pdu->buffer, packet, length);
+    // Publish the slot content before the new head
+    __DMB();
+    ipc_shared_data.rx_ring.head = head + 1;
+
+    // Coalesce the RX events when the user image asked for it
+    uint8_t batch_size = ipc_shared_data.rx_filter.batch_size;
+    if (batch_size <= 1 || ++_app_vars.rx_unnotified >= batch_size) {
+        _app_vars.data_received = true;
+    } else if (_app_vars.rx_unnotified == 1) {
+        mr_timer_hf_set_oneshot_us(NETCORE_MAIN_TIMER, NETCORE_RX_TIMER_CHANNEL, ipc_shared_data.rx_filter.batch_delay_us, _rx_batch_timeout);
+    }
 }
 
 static void mari_event_callback(mr_event_t event, mr_event_data_t event_data) {
@@ -96,6 +167,8 @@ static void mari_event_callback(mr_event_t event, mr_event_data_t event_data) {
         case MARI_CONNECTED: {
             uint64_t gateway_id = event_data.data.gateway_info.gateway_id;
             printf("Connected to gateway %016llX\n", gateway_id);
+            // Send the PDUs queued while disconnected
+            _app_vars.tx_requested = true;
             break;
         }
         case MARI_DISCONNECTED: {
@@ -104,7 +177,7 @@ static void mari_event_callback(mr_event_t event, mr_event_data_t event_data) {
             break;
         }
         case MARI_ERROR:
-            printf("Error\n");
+            LOG_ERROR("Error\n");
             break;
         default:
             break;
@@ -115,8 +188,221 @@ uint64_t _deviceid(void) {
     return ((uint64_t)NRF_FICR_NS->INFO.DEVICEID[1]) << 32 | (uint64_t)NRF_FICR_NS->INFO.DEVICEID[0];
 }
 
+static bool _ota_allowed(void) {
+    // Images received while the user image runs are staged by the application core
+    return ipc_shared_data.status == SWRMT_APPLICATION_READY || ipc_shared_data.status == SWRMT_APPLICATION_PROGRAMMING || ipc_shared_data.status == SWRMT_APPLICATION_RUNNING;
+}
+
+static void _execute_cmd(volatile ipc_cmd_t *cmd) {
+    switch (cmd->req) {
+        // Mira node functions
+        case IPC_MARI_INIT_REQ:
+            mari_init(MARI_NODE, SWARMIT_MARI_NET_ID, &schedule_tiny, &mari_event_callback);
+            cmd->length = 0;
+            break;
+        case IPC_RNG_INIT_REQ:
+            db_rng_init();
+            _app_vars.rng_ready = true;
+            _app_vars.entropy_requested = true;
+            cmd->length = 0;
+            break;
+        case IPC_RNG_READ_REQ:
+        {
+            uint8_t length = (cmd->length && cmd->data[0] <= IPC_CMD_DATA_SIZE) ? cmd->data[0] : 0;
+            for (uint8_t i = 0; i < length; i++) {
+                db_rng_read((uint8_t *)&cmd->data[i]);
+            }
+            cmd->length = length;
+        } break;
+        default:
+            cmd->length = 0;
+            break;
+    }
+}
+
+static void _reply_metrics_probe(mr_metrics_payload_t *metrics_payload) {
+    // update metrics probe
+    metrics_payload->node_rx_count        = ++_app_vars.metrics_rx_counter;
+    metrics_payload->node_rx_asn          = mr_mac_get_asn();
+    metrics_payload->node_tx_count        = ++_app_vars.metrics_tx_counter;
+    metrics_payload->node_tx_enqueued_asn = mr_mac_get_asn();
+    metrics_payload->rssi_at_node         = mr_radio_rssi();
+
+    // send metrics probe to gateway
+    mari_node_tx_payload((uint8_t *)metrics_payload, sizeof(mr_metrics_payload_t));
+}
+
+static void _send_log_records(void) {
+    volatile ipc_log_ring_t *ring = &ipc_shared_data.log_records;
+    // Batch as many records as fit in each notification, all records of a notification share its timestamp
+    while (ring->tail != ring->head) {
+        size_t length = 0;
+        _app_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_LOG_RECORDS;
+        uint32_t timestamp = mr_timer_hf_now(NETCORE_MAIN_TIMER);
+        memcpy(_app_vars.notification_buffer + length, &timestamp, sizeof(uint32_t));
+        length += sizeof(uint32_t);
+        size_t size_pos = length++;
+        uint8_t tail = ring->tail;
+        while (tail != ring->head) {
+            // Read the record after the head
+            __DMB();
+            volatile ipc_log_record_t *record = &ring->records[tail & (IPC_LOG_RECORD_SLOTS - 1)];
+            // The ring is writable by the user image, the count is read once and checked
+            uint8_t count = record->count;
+            if (count > IPC_LOG_RECORD_ARGS_MAX) {
+                ring->dropped++;
+                tail++;
+                continue;
+            }
+            size_t args_size = count * sizeof(uint32_t);
+            if (length - size_pos - 1 + sizeof(uint32_t) + 1 + args_size > SWRMT_LOG_RECORDS_MAX_SIZE) {
+                break;
+            }
+            memcpy(_app_vars.notification_buffer + length, (void *)&record->fmt, sizeof(uint32_t));
+            length += sizeof(uint32_t);
+            _app_vars.notification_buffer[length++] = count;
+            memcpy(_app_vars.notification_buffer + length, (void *)record->args, args_size);
+            length += args_size;
+            tail++;
+        }
+        // Release the slots once copied
+        __DMB();
+        ring->tail = tail;
+        if (length == size_pos + 1) {
+            // Only invalid records were dropped
+            continue;
+        }
+        _app_vars.notification_buffer[size_pos] = length - size_pos - 1;
+        mari_node_tx_payload(_app_vars.notification_buffer, length);
+    }
+}
+
+static size_t _varint_size(uint32_t value) {
+    size_t size = 1;
+    while (value >= 0x80) {
+        value >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static void _log_flush_timeout(void) {
+    _app_vars.log_flush_requested = true;
+}
+
+static void _flush_log_events(void) {
+    if (_app_vars.log_events_length == 0) {
+        return;
+    }
+    size_t length = 0;
+    _app_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_LOG_EVENT;
+    memcpy(_app_vars.notification_buffer + length, &_app_vars.log_events_timestamp, sizeof(uint32_t));
+    length += sizeof(uint32_t);
+    _app_vars.notification_buffer[length++] = _app_vars.log_events_length;
+    memcpy(_app_vars.notification_buffer + length, _app_vars.log_events, _app_vars.log_events_length);
+    length += _app_vars.log_events_length;
+    mari_node_tx_payload(_app_vars.notification_buffer, length);
+    _app_vars.log_events_length = 0;
+}
+
+static void _queue_log_events(void) {
+    volatile ipc_log_data_t *log = &ipc_shared_data.log;
+    uint16_t tail = log->tail;
+    while (tail != log->head) {
+        uint16_t head = log->head;
+        // Read the entry after the head
+        __DMB();
+        uint8_t entry_length = log->data[tail & (IPC_LOG_RING_SIZE - 1)];
+        // The ring is writable by the user image, an entry must be complete and fit in a notification
+        if (entry_length + 1 > (uint16_t)(head - tail) || entry_length > NETCORE_LOG_ENTRY_MAX_SIZE) {
+            // The entry boundaries are lost, drop everything queued so far
+            log->dropped++;
+            __DMB();
+            log->tail = head;
+            break;
+        }
+        // Entries are timestamped when read from the ring, the application core has no access to the network core clock
+        uint32_t timestamp = mr_timer_hf_now(NETCORE_MAIN_TIMER);
+        if (_app_vars.log_events_length == 0) {
+            _app_vars.log_events_timestamp = timestamp;
+            _app_vars.log_last_timestamp = timestamp;
+        }
+        uint32_t delta = timestamp - _app_vars.log_last_timestamp;
+        if (_app_vars.log_events_length + _varint_size(delta) + 1 + entry_length > SWRMT_LOG_EVENTS_MAX_SIZE) {
+            // The notification is full, the entry starts the next one
+            _flush_log_events();
+            continue;
+        }
+        if (_app_vars.log_events_length == 0) {
+            // Entries wait at most NETCORE_LOG_FLUSH_DELAY_US for the notification to fill up
+            mr_timer_hf_set_oneshot_us(NETCORE_MAIN_TIMER, NETCORE_LOG_TIMER_CHANNEL, NETCORE_LOG_FLUSH_DELAY_US, _log_flush_timeout);
+        }
+
+        // Timestamp delta in microseconds, 7 bits per byte, least significant bits first
+        while (delta >= 0x80) {
+            _app_vars.log_events[_app_vars.log_events_length++] = (delta & 0x7F) | 0x80;
+            delta >>= 7;
+        }
+        _app_vars.log_events[_app_vars.log_events_length++] = delta;
+        _app_vars.log_events[_app_vars.log_events_length++] = entry_length;
+        tail++;
+        for (uint8_t i = 0; i < entry_length; i++) {
+            _app_vars.log_events[_app_vars.log_events_length++] = log->data[tail++ & (IPC_LOG_RING_SIZE - 1)];
+        }
+        _app_vars.log_last_timestamp = timestamp;
+
+        // Release the entry once copied
+        __DMB();
+        log->tail = tail;
+    }
+}
+
+static void _check_status(void) {
+    _app_vars.check_status = true;
+}
+
+static uint32_t _abs_diff(uint32_t a, uint32_t b) {
+    return (a > b) ? a - b : b - a;
+}
+
+static bool _status_changed(void) {
+    if (ipc_shared_data.status != _app_vars.status_last) {
+        return true;
+    }
+    const swrmt_status_policy_pkt_t *policy = &_app_vars.status_policy;
+    if (policy->battery_delta && _abs_diff(ipc_shared_data.battery_level, _app_vars.battery_last) >= policy->battery_delta) {
+        return true;
+    }
+    if (policy->position_delta && (_abs_diff(ipc_shared_data.current_position.x, _app_vars.position_last.x) >= policy->position_delta ||
+                                   _abs_diff(ipc_shared_data.current_position.y, _app_vars.position_last.y) >= policy->position_delta)) {
+        return true;
+    }
+    return false;
+}
+
 static void _send_status(void) {
-    _app_vars.send_status = true;
+    size_t length = 0;
+    _app_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_STATUS;
+    _app_vars.notification_buffer[length++] = ipc_shared_data.device_type;
+    _app_vars.notification_buffer[length++] = ipc_shared_data.status;
+    memcpy(&_app_vars.notification_buffer[length], (void *)&ipc_shared_data.battery_level, sizeof(uint16_t));
+    length += sizeof(uint16_t);
+    memcpy(&_app_vars.notification_buffer[length], (void *)&ipc_shared_data.current_position, sizeof(position_2d_t));
+    length += sizeof(position_2d_t);
+    memcpy(&_app_vars.notification_buffer[length], (void *)ipc_shared_data.image_hash, SWRMT_IMAGE_HASH_LENGTH);
+    length += SWRMT_IMAGE_HASH_LENGTH;
+    // Received packets dropped by the request queue or the RX ring of the application core
+    uint32_t rx_dropped = _app_vars.frames_dropped + ipc_shared_data.rx_ring.dropped;
+    memcpy(&_app_vars.notification_buffer[length], &rx_dropped, sizeof(uint32_t));
+    length += sizeof(uint32_t);
+    mari_node_tx_payload(_app_vars.notification_buffer, length);
+
+    // Next deltas are relative to the values sent
+    _app_vars.status_last = ipc_shared_data.status;
+    _app_vars.battery_last = ipc_shared_data.battery_level;
+    _app_vars.position_last.x = ipc_shared_data.current_position.x;
+    _app_vars.position_last.y = ipc_shared_data.current_position.y;
+    _app_vars.status_elapsed_ms = 0;
 }
 
 //=========================== main ==============================================
@@ -125,15 +411,22 @@ int main(void) {
 
     _app_vars.device_id = _deviceid();
 
-    NRF_IPC_NS->INTENSET                             = (1 << IPC_CHAN_REQ) | (1 << IPC_CHAN_LOG_EVENT);
+    NRF_IPC_NS->INTENSET                             = (1 << IPC_CHAN_REQ) | (1 << IPC_CHAN_LOG_EVENT) | (1 << IPC_CHAN_RADIO_TX) | (1 << IPC_CHAN_ENTROPY) | (1 << IPC_CHAN_LOCK_RELEASE) | (1 << IPC_CHAN_LOG_RECORD);
     NRF_IPC_NS->SEND_CNF[IPC_CHAN_RADIO_RX]          = 1 << IPC_CHAN_RADIO_RX;
     NRF_IPC_NS->SEND_CNF[IPC_CHAN_APPLICATION_START] = 1 << IPC_CHAN_APPLICATION_START;
     NRF_IPC_NS->SEND_CNF[IPC_CHAN_APPLICATION_STOP]  = 1 << IPC_CHAN_APPLICATION_STOP;
     //NRF_IPC_NS->SEND_CNF[IPC_CHAN_APPLICATION_RESET] = 1 << IPC_CHAN_APPLICATION_RESET;
     NRF_IPC_NS->SEND_CNF[IPC_CHAN_OTA_START]         = 1 << IPC_CHAN_OTA_START;
     NRF_IPC_NS->SEND_CNF[IPC_CHAN_OTA_CHUNK]         = 1 << IPC_CHAN_OTA_CHUNK;
+    NRF_IPC_NS->SEND_CNF[IPC_CHAN_OTA_STATUS]        = 1 << IPC_CHAN_OTA_STATUS;
+    NRF_IPC_NS->SEND_CNF[IPC_CHAN_OTA_PAGE_HASHES]   = 1 << IPC_CHAN_OTA_PAGE_HASHES;
+    NRF_IPC_NS->SEND_CNF[IPC_CHAN_LOCK_RELEASE]      = 1 << IPC_CHAN_LOCK_RELEASE;
     NRF_IPC_NS->RECEIVE_CNF[IPC_CHAN_REQ]            = 1 << IPC_CHAN_REQ;
     NRF_IPC_NS->RECEIVE_CNF[IPC_CHAN_LOG_EVENT]      = 1 << IPC_CHAN_LOG_EVENT;
+    NRF_IPC_NS->RECEIVE_CNF[IPC_CHAN_RADIO_TX]       = 1 << IPC_CHAN_RADIO_TX;
+    NRF_IPC_NS->RECEIVE_CNF[IPC_CHAN_ENTROPY]        = 1 << IPC_CHAN_ENTROPY;
+    NRF_IPC_NS->RECEIVE_CNF[IPC_CHAN_LOCK_RELEASE]   = 1 << IPC_CHAN_LOCK_RELEASE;
+    NRF_IPC_NS->RECEIVE_CNF[IPC_CHAN_LOG_RECORD]     = 1 << IPC_CHAN_LOG_RECORD;
 
     NVIC_EnableIRQ(IPC_IRQn);
     NVIC_ClearPendingIRQ(IPC_IRQn);
@@ -141,43 +434,77 @@ int main(void) {
 
     // Configure timer used for timestamping events
     mr_timer_hf_init(NETCORE_MAIN_TIMER);
-    mr_timer_hf_set_periodic_us(NETCORE_MAIN_TIMER, 0, 1000000UL, _send_status);
+    _app_vars.status_policy.heartbeat_ms = NETCORE_STATUS_HEARTBEAT_MS_DEFAULT;
+    _app_vars.status_policy.battery_delta = NETCORE_STATUS_BATTERY_DELTA_DEFAULT;
+    _app_vars.status_policy.position_delta = NETCORE_STATUS_POSITION_DELTA_DEFAULT;
+    // Send the first status notification at the first check
+    _app_vars.status_elapsed_ms = NETCORE_STATUS_HEARTBEAT_MS_DEFAULT;
+    mr_timer_hf_set_periodic_us(NETCORE_MAIN_TIMER, NETCORE_STATUS_TIMER_CHANNEL, NETCORE_STATUS_CHECK_PERIOD_MS * 1000UL, _check_status);
+
+    // Drop the commands and PDUs left in shared RAM, the application core posts new ones once ready
+    ipc_shared_data.mailbox.tail = ipc_shared_data.mailbox.head;
+    ipc_shared_data.tx_ring.tail = ipc_shared_data.tx_ring.head;
+    ipc_shared_data.rx_ring.dropped = 0;
+    ipc_shared_data.log.tail = ipc_shared_data.log.head;
+    ipc_shared_data.log.dropped = 0;
+    ipc_shared_data.log_records.tail = ipc_shared_data.log_records.head;
+    ipc_shared_data.log_records.dropped = 0;
 
     // Network core must remain on
     ipc_shared_data.net_ready = true;
 
     while (1) {
+        // Print the pending log messages before sleeping
+        log_flush();
         __WFE();
 
-        if (_app_vars.send_status) {
-            _app_vars.send_status = false;
-            size_t length = 0;
-            _app_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_STATUS;
-            _app_vars.notification_buffer[length++] = ipc_shared_data.device_type;
-            _app_vars.notification_buffer[length++] = ipc_shared_data.status;
-            memcpy(&_app_vars.notification_buffer[length], (void *)&ipc_shared_data.battery_level, sizeof(uint16_t));
-            length += sizeof(uint16_t);
-            memcpy(&_app_vars.notification_buffer[length], (void *)&ipc_shared_data.current_position, sizeof(position_2d_t));
-            length += sizeof(position_2d_t);
-            mari_node_tx_payload(_app_vars.notification_buffer, length);
+        if (_app_vars.check_status) {
+            _app_vars.check_status = false;
+            _app_vars.status_elapsed_ms += NETCORE_STATUS_CHECK_PERIOD_MS;
+            // Only send the status when it changed, or as a heartbeat
+            if (_status_changed() || _app_vars.status_elapsed_ms >= _app_vars.status_policy.heartbeat_ms) {
+                _send_status();
+            }
         }
 
-        if (_app_vars.req_received) {
-            _app_vars.req_received = false;
-            swrmt_request_t *req = (swrmt_request_t *)_app_vars.req_buffer;
+        // Handle all the frames received since the last iteration, in order
+        while (_app_vars.frames_tail != _app_vars.frames_head) {
+            swrmt_frame_t *frame = &_app_vars.frames[_app_vars.frames_tail & (NETCORE_FRAME_SLOTS - 1)];
+            swrmt_request_t *req = (swrmt_request_t *)frame->data;
+            if (frame->data[0] == MARI_PAYLOAD_TYPE_METRICS_PROBE) {
+                _reply_metrics_probe((mr_metrics_payload_t *)frame->data);
+            }
             switch (req->type) {
+                case SWRMT_REQUEST_STATUS:
+                    _send_status();
+                    break;
+                case SWRMT_REQUEST_STATUS_POLICY:
+                {
+                    if (frame->length < offsetof(swrmt_request_t, data) + sizeof(swrmt_status_policy_pkt_t)) {
+                        break;
+                    }
+                    const swrmt_status_policy_pkt_t *pkt = (const swrmt_status_policy_pkt_t *)req->data;
+                    memcpy(&_app_vars.status_policy, pkt, sizeof(swrmt_status_policy_pkt_t));
+                    if (_app_vars.status_policy.heartbeat_ms < NETCORE_STATUS_CHECK_PERIOD_MS) {
+                        _app_vars.status_policy.heartbeat_ms = NETCORE_STATUS_CHECK_PERIOD_MS;
+                    }
+                    LOG_INFO("Status policy (heartbeat: %ums, battery: %umV, position: %u)\n", _app_vars.status_policy.heartbeat_ms, _app_vars.status_policy.battery_delta, _app_vars.status_policy.position_delta);
+                    // Acknowledged by the status notification
+                    _send_status();
+                } break;
                 case SWRMT_REQUEST_START:
                     if (ipc_shared_data.status != SWRMT_APPLICATION_READY) {
                         break;
                     }
-                    puts("Start request received");
+                    LOG_INFO("Start request received\n");
+                    _app_vars.ota_staging = false;
                     NRF_IPC_NS->TASKS_SEND[IPC_CHAN_APPLICATION_START] = 1;
                     break;
                 case SWRMT_REQUEST_STOP:
                     if ((ipc_shared_data.status != SWRMT_APPLICATION_RUNNING) && (ipc_shared_data.status != SWRMT_APPLICATION_RESETTING) && (ipc_shared_data.status != SWRMT_APPLICATION_PROGRAMMING)) {
                         break;
                     }
-                    puts("Stop request received");
+                    LOG_INFO("Stop request received\n");
                     ipc_shared_data.status = SWRMT_APPLICATION_STOPPING;
                     NRF_IPC_NS->TASKS_SEND[IPC_CHAN_APPLICATION_STOP] = 1;
                     break;
@@ -186,127 +513,191 @@ int main(void) {
                         break;
                     }
                     memcpy((uint8_t *)&ipc_shared_data.target_position, req->data, sizeof(position_2d_t));
-                    puts("Reset request received");
+                    LOG_INFO("Reset request received\n");
                     ipc_shared_data.status = SWRMT_APPLICATION_RESETTING;
                     //NRF_IPC_NS->TASKS_SEND[IPC_CHAN_APPLICATION_RESET] = 1;
                     break;
                 case SWRMT_REQUEST_OTA_START:
                 {
-                    if (ipc_shared_data.status != SWRMT_APPLICATION_READY && ipc_shared_data.status != SWRMT_APPLICATION_PROGRAMMING) {
+                    if (!_ota_allowed()) {
                         break;
                     }
-                    ipc_shared_data.ota.last_chunk_acked = -1;
-                    ipc_shared_data.status = SWRMT_APPLICATION_PROGRAMMING;
                     const swrmt_ota_start_pkt_t *pkt = (const swrmt_ota_start_pkt_t *)req->data;
+                    // The user image keeps running while the new image is staged, only when explicitly requested
+                    if (ipc_shared_data.status == SWRMT_APPLICATION_RUNNING && !pkt->stage) {
+                        break;
+                    }
+                    _app_vars.ota_staging = ipc_shared_data.status == SWRMT_APPLICATION_RUNNING;
+                    if (!_app_vars.ota_staging) {
+                        ipc_shared_data.status = SWRMT_APPLICATION_PROGRAMMING;
+                    }
                     // Erase the corresponding flash pages.
-                    mutex_lock();
+                    ipc_lock(IPC_LOCK_OTA_PARAMS);
                     ipc_shared_data.ota.image_size = pkt->image_size;
                     ipc_shared_data.ota.chunk_count = pkt->chunk_count;
-                    mutex_unlock();
-                    printf("OTA Start request received (size: %u, chunks: %u)\n", ipc_shared_data.ota.image_size, ipc_shared_data.ota.chunk_count);
+                    ipc_shared_data.ota.chunk_size = pkt->chunk_size;
+                    ipc_shared_data.ota.ack_interval = pkt->ack_interval;
+                    ipc_shared_data.ota.mode = pkt->mode;
+                    ipc_shared_data.ota.base_size = pkt->base_size;
+                    memcpy((void *)ipc_shared_data.ota.base_hash, pkt->base_hash, sizeof(pkt->base_hash));
+                    memcpy((void *)ipc_shared_data.ota.pages, pkt->pages, sizeof(pkt->pages));
+                    memcpy((void *)ipc_shared_data.ota.image_hash, pkt->image_hash, sizeof(pkt->image_hash));
+                    ipc_unlock(IPC_LOCK_OTA_PARAMS);
+                    LOG_INFO("OTA Start request received (size: %u, chunks: %u)\n", ipc_shared_data.ota.image_size, ipc_shared_data.ota.chunk_count);
                     NRF_IPC_NS->TASKS_SEND[IPC_CHAN_OTA_START] = 1;
                 } break;
                 case SWRMT_REQUEST_OTA_CHUNK:
                 {
-                    if (ipc_shared_data.status != SWRMT_APPLICATION_PROGRAMMING) {
+                    if (ipc_shared_data.status != SWRMT_APPLICATION_PROGRAMMING && !(ipc_shared_data.status == SWRMT_APPLICATION_RUNNING && _app_vars.ota_staging)) {
                         break;
                     }
 
                     const swrmt_ota_chunk_pkt_t *pkt = (const swrmt_ota_chunk_pkt_t *)req->data;
-                    ipc_shared_data.ota.chunk_index = pkt->index;
 
-                    // Check chunk index is valid
-                    if (ipc_shared_data.ota.chunk_index >= ipc_shared_data.ota.chunk_count) {
-                        printf("Invalid chunk index %u\n", ipc_shared_data.ota.chunk_index);
+                    // Check chunk index is valid, chunks can be received in any order
+                    uint32_t chunk_index = pkt->index;
+                    if (ipc_shared_data.ota.mode & SWRMT_OTA_MODE_FOUNTAIN) {
+                        // Check the first chunk of the symbol generation
+                        chunk_index = (pkt->index >> 16) * SWRMT_OTA_FOUNTAIN_GENERATION_SIZE;
+                    }
+                    if (chunk_index >= ipc_shared_data.ota.chunk_count) {
+                        LOG_WARNING("Invalid chunk index %u\n", pkt->index);
                         break;
                     }
 
-                    // Only check for matching sha if chunk was not already acked
-                    if (ipc_shared_data.ota.last_chunk_acked != (int32_t)ipc_shared_data.ota.chunk_index) {
-                        printf("Verify SHA for chunk %u: ", ipc_shared_data.ota.chunk_index);
-                        ipc_shared_data.ota.chunk_size = pkt->chunk_size;
-                        mutex_lock();
-                        memcpy((uint8_t *)ipc_shared_data.ota.chunk, pkt->chunk, pkt->chunk_size);
-                        mutex_unlock();
-
-                        // Copy expected hash
-                        memcpy(_app_vars.expected_hash, pkt->sha, SWRMT_OTA_SHA256_LENGTH);
-
-                        // Compute and compare the chunk hash with the received one
-                        crypto_sha256_init();
-                        mutex_lock();
-                        crypto_sha256_update((const uint8_t *)ipc_shared_data.ota.chunk, ipc_shared_data.ota.chunk_size);
-                        mutex_unlock();
-                        crypto_sha256(_app_vars.computed_hash);
-
-                        if (memcmp(_app_vars.computed_hash, _app_vars.expected_hash, 8) != 0) {
-                            puts("Failed");
-                            break;
-                        }
-                        puts("OK");
+                    // Chunks can't be larger than the size given in the start request
+                    if (pkt->chunk_size > ipc_shared_data.ota.chunk_size || pkt->chunk_size > SWRMT_OTA_CHUNK_SIZE_MAX) {
+                        LOG_WARNING("Invalid chunk size %u\n", pkt->chunk_size);
+                        break;
+                    }
+
+                    // Copy expected hash
+                    memcpy(_app_vars.expected_hash, pkt->sha, SWRMT_OTA_SHA256_LENGTH);
+
+                    // Compute and compare the chunk hash with the received one
+                    crypto_sha256_init();
+                    crypto_sha256_update(pkt->chunk, pkt->chunk_size);
+                    crypto_sha256(_app_vars.computed_hash);
+
+                    if (memcmp(_app_vars.computed_hash, _app_vars.expected_hash, 8) != 0) {
+                        LOG_WARNING("Chunk %u hash mismatch\n", pkt->index);
+                        break;
+                    }
+                    LOG_DEBUG("Chunk %u hash OK\n", pkt->index);
+
+                    // Stage the chunk in the next free slot, the application core writes staged chunks to flash
+                    // in order while the next ones are received and verified
+                    uint8_t head = ipc_shared_data.ota.chunks_head;
+                    if ((uint8_t)(head - ipc_shared_data.ota.chunks_tail) >= IPC_OTA_CHUNK_SLOTS) {
+                        // Not acknowledged, the chunk is sent again
+                        LOG_WARNING("No free OTA slot, drop chunk %u\n", pkt->index);
+                        break;
                     }
-                    printf("Process OTA chunk request (index: %u, size: %u)\n", ipc_shared_data.ota.chunk_index, ipc_shared_data.ota.chunk_size);
+                    volatile ipc_ota_chunk_t *slot = &ipc_shared_data.ota.chunks[head & (IPC_OTA_CHUNK_SLOTS - 1)];
+                    slot->index = pkt->index;
+                    slot->size = pkt->chunk_size;
+                    memcpy((uint8_t *)slot->data, pkt->chunk, pkt->chunk_size);
+                    // Publish the slot content before the new head
+                    __DMB();
+                    ipc_shared_data.ota.chunks_head = head + 1;
+
+                    LOG_DEBUG("Process OTA chunk request (index: %u, size: %u)\n", pkt->index, pkt->chunk_size);
                     NRF_IPC_NS->TASKS_SEND[IPC_CHAN_OTA_CHUNK] = 1;
                 } break;
+                case SWRMT_REQUEST_OTA_STATUS:
+                    if (!_ota_allowed()) {
+                        break;
+                    }
+                    // The application core replies with the bitmap of received chunks
+                    NRF_IPC_NS->TASKS_SEND[IPC_CHAN_OTA_STATUS] = 1;
+                    break;
+                case SWRMT_REQUEST_OTA_PAGE_HASHES:
+                {
+                    if (!_ota_allowed()) {
+                        break;
+                    }
+                    const swrmt_ota_page_hashes_request_pkt_t *pkt = (const swrmt_ota_page_hashes_request_pkt_t *)req->data;
+                    if (pkt->page_count > SWRMT_OTA_PAGE_HASHES_MAX) {
+                        break;
+                    }
+                    ipc_lock(IPC_LOCK_OTA_PARAMS);
+                    ipc_shared_data.ota.hashes_first_page = pkt->first_page;
+                    ipc_shared_data.ota.hashes_page_count = pkt->page_count;
+                    ipc_shared_data.ota.hashes_size = pkt->size;
+                    ipc_unlock(IPC_LOCK_OTA_PARAMS);
+                    // The application core replies with the hashes of the requested pages
+                    NRF_IPC_NS->TASKS_SEND[IPC_CHAN_OTA_PAGE_HASHES] = 1;
+                } break;
                 default:
                     break;
             }
+            // Release the slot once handled
+            _app_vars.frames_tail++;
         }
 
-        if (_app_vars.ipc_req != IPC_REQ_NONE) {
-            ipc_shared_data.net_ack = false;
-            switch (_app_vars.ipc_req) {
-                // Mira node functions
-                case IPC_MARI_INIT_REQ:
-                    mari_init(MARI_NODE, SWARMIT_MARI_NET_ID, &schedule_tiny, &mari_event_callback);
-                    break;
-                case IPC_MARI_NODE_TX_REQ:
-                    while (!mari_node_is_connected()) {}
-                    mari_node_tx_payload((uint8_t *)ipc_shared_data.tx_pdu.buffer, ipc_shared_data.tx_pdu.length);
-                    break;
-                case IPC_RNG_INIT_REQ:
-                    db_rng_init();
-                    break;
-                case IPC_RNG_READ_REQ:
-                    db_rng_read((uint8_t *)&ipc_shared_data.rng.value);
-                    break;
-                default:
-                    break;
+        if (_app_vars.cmd_received) {
+            _app_vars.cmd_received = false;
+            // Execute all the commands posted since the last event
+            uint8_t tail = ipc_shared_data.mailbox.tail;
+            while (tail != ipc_shared_data.mailbox.head) {
+                // Read the command after the head
+                __DMB();
+                _execute_cmd(&ipc_shared_data.mailbox.cmds[tail & (IPC_CMD_SLOTS - 1)]);
+                // Publish the result before the new tail
+                __DMB();
+                ipc_shared_data.mailbox.tail = ++tail;
+            }
+        }
+
+        // PDUs queued by the application core wait in the ring until the node is connected
+        if (_app_vars.tx_requested && mari_node_is_connected()) {
+            _app_vars.tx_requested = false;
+            uint8_t tail = ipc_shared_data.tx_ring.tail;
+            while (tail != ipc_shared_data.tx_ring.head) {
+                // Read the slot content after the head
+                __DMB();
+                volatile ipc_radio_pdu_t *pdu = &ipc_shared_data.tx_ring.pdus[tail & (IPC_RADIO_PDU_SLOTS - 1)];
+                mari_node_tx_payload((uint8_t *)pdu->buffer, pdu->length);
+                __DMB();
+                ipc_shared_data.tx_ring.tail = ++tail;
+            }
+        }
+
+        // Refill the entropy pool a few bytes at a time, so radio events are not delayed
+        if (_app_vars.entropy_requested && _app_vars.rng_ready) {
+            uint8_t head = ipc_shared_data.entropy.head;
+            for (uint8_t i = 0; i < NETCORE_ENTROPY_REFILL_MAX && (uint8_t)(head - ipc_shared_data.entropy.tail) < IPC_ENTROPY_POOL_SIZE; i++) {
+                db_rng_read((uint8_t *)&ipc_shared_data.entropy.data[head++ & (IPC_ENTROPY_POOL_SIZE - 1)]);
+            }
+            // Publish the bytes before the new head
+            __DMB();
+            ipc_shared_data.entropy.head = head;
+            _app_vars.entropy_requested = (uint8_t)(head - ipc_shared_data.entropy.tail) < IPC_ENTROPY_POOL_SIZE;
+            if (_app_vars.entropy_requested) {
+                // Don't wait for the next event if the pool is not full
+                __SEV();
             }
-            ipc_shared_data.net_ack = true;
-            _app_vars.ipc_req      = IPC_REQ_NONE;
         }
 
         if (_app_vars.data_received) {
             _app_vars.data_received = false;
+            _app_vars.rx_unnotified = 0;
             NRF_IPC_NS->TASKS_SEND[IPC_CHAN_RADIO_RX] = 1;
         }
 
-        if (_app_vars.metrics_received) {
-            _app_vars.metrics_received = false;
-            mr_metrics_payload_t *metrics_payload = (mr_metrics_payload_t *)_app_vars.req_buffer;
-            // update metrics probe
-            metrics_payload->node_rx_count        = ++_app_vars.metrics_rx_counter;
-            metrics_payload->node_rx_asn          = mr_mac_get_asn();
-            metrics_payload->node_tx_count        = ++_app_vars.metrics_tx_counter;
-            metrics_payload->node_tx_enqueued_asn = mr_mac_get_asn();
-            metrics_payload->rssi_at_node         = mr_radio_rssi();
-
-            // send metrics probe to gateway
-            mari_node_tx_payload((uint8_t *)metrics_payload, sizeof(mr_metrics_payload_t));
-        }
-
         if (_app_vars.ipc_log_received) {
             _app_vars.ipc_log_received = false;
-            // Notify log data
-            size_t length = 0;
-            _app_vars.notification_buffer[length++] = SWRMT_NOTIFICATION_LOG_EVENT;
-            uint32_t timestamp = mr_timer_hf_now(NETCORE_MAIN_TIMER);
-            memcpy(_app_vars.notification_buffer + length, &timestamp, sizeof(uint32_t));
-            length += sizeof(uint32_t);
-            memcpy(_app_vars.notification_buffer + length, (void *)&ipc_shared_data.log, ipc_shared_data.log.length + 1);
-            length += ipc_shared_data.log.length + 1;
-            mari_node_tx_payload(_app_vars.notification_buffer, length);
+            _queue_log_events();
+        }
+
+        if (_app_vars.log_flush_requested) {
+            _app_vars.log_flush_requested = false;
+            _flush_log_events();
+        }
+
+        if (_app_vars.log_records_received) {
+            _app_vars.log_records_received = false;
+            _send_log_records();
         }
     };
 }
@@ -314,11 +705,31 @@ int main(void) {
 void IPC_IRQHandler(void) {
     if (NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_REQ]) {
         NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_REQ] = 0;
-        _app_vars.ipc_req                        = ipc_shared_data.req;
+        _app_vars.cmd_received                   = true;
     }
 
     if (NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_LOG_EVENT]) {
         NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_LOG_EVENT] = 0;
         _app_vars.ipc_log_received                     = true;
     }
+
+    if (NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_LOG_RECORD]) {
+        NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_LOG_RECORD] = 0;
+        _app_vars.log_records_received                  = true;
+    }
+
+    if (NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_RADIO_TX]) {
+        NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_RADIO_TX] = 0;
+        _app_vars.tx_requested                        = true;
+    }
+
+    if (NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_ENTROPY]) {
+        NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_ENTROPY] = 0;
+        _app_vars.entropy_requested                  = true;
+    }
+
+    if (NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_LOCK_RELEASE]) {
+        // Only wakes up ipc_lock
+        NRF_IPC_NS->EVENTS_RECEIVE[IPC_CHAN_LOCK_RELEASE] = 0;
+    }
 }
@@ -9,8 +9,16 @@
 #define BROADCAST_ADDRESS 0xffffffffffffffffUL  ///< Broadcast address
 #define GATEWAY_ADDRESS   0x0000000000000000UL  ///< Gateway address
 
-#define SWRMT_OTA_CHUNK_SIZE        (64U)
+#define SWRMT_OTA_CHUNK_SIZE_MIN    (128U)  ///< Smallest chunk size accepted, bounds the number of chunks of an image
+#define SWRMT_OTA_CHUNK_SIZE_MAX    (220U)  ///< Largest chunk fitting in a Mari payload with the chunk request header, multiple of 4
 #define SWRMT_OTA_SHA256_LENGTH     (32U)
+#define SWRMT_OTA_PAGES_BITMAP_SIZE (30U)   ///< Bitmap covering the 240 flash pages of the non secure image region
+#define SWRMT_OTA_PAGE_HASH_LENGTH  (8U)    ///< Length of the truncated SHA256 of a flash page
+#define SWRMT_IMAGE_HASH_LENGTH     (8U)    ///< Length of the truncated SHA256 identifying a user image
+#define SWRMT_OTA_PAGE_HASHES_MAX   (28U)   ///< Max page hashes per notification
+#define SWRMT_LOG_RECORDS_MAX_SIZE  (220U)  ///< Max binary log records bytes per notification
+#define SWRMT_LOG_EVENTS_MAX_SIZE   (220U)  ///< Max log entries bytes per notification
+#define SWRMT_OTA_FOUNTAIN_GENERATION_SIZE (16U)  ///< Number of chunks combined in fountain coded symbols
 
 typedef enum {
     SWRMT_DEVICE_TYPE_UNKNOWN = 0,
@@ -27,6 +35,13 @@ typedef enum {
     SWRMT_APPLICATION_PROGRAMMING,
 } swrmt_application_status_t;
 
+typedef enum {
+    SWRMT_OTA_MODE_RAW = 0,                     ///< Chunks hold raw image bytes
+    SWRMT_OTA_MODE_LZ = 1 << 0,                 ///< Chunks hold LZ compressed blocks, decompressed in order
+    SWRMT_OTA_MODE_DELTA = 1 << 1,              ///< Chunks hold a delta patch of the installed image, can be combined with LZ
+    SWRMT_OTA_MODE_FOUNTAIN = 1 << 2,           ///< Chunks are fountain coded symbols of the raw image, not acknowledged
+} swrmt_ota_mode_t;
+
 typedef enum {
     SWRMT_REQUEST_STATUS = 0x80,
     SWRMT_REQUEST_START = 0x81,
@@ -34,6 +49,9 @@ typedef enum {
     SWRMT_REQUEST_RESET = 0x83,
     SWRMT_REQUEST_OTA_START = 0x84,
     SWRMT_REQUEST_OTA_CHUNK = 0x85,
+    SWRMT_REQUEST_OTA_STATUS = 0x86,
+    SWRMT_REQUEST_OTA_PAGE_HASHES = 0x87,
+    SWRMT_REQUEST_STATUS_POLICY = 0x88,
 } swrmt_request_type_t;
 
 typedef enum {
@@ -42,6 +60,9 @@ typedef enum {
     SWRMT_NOTIFICATION_OTA_CHUNK_ACK = 0x94,
     SWRMT_NOTIFICATION_GPIO_EVENT = 0x95,
     SWRMT_NOTIFICATION_LOG_EVENT = 0x96,
+    SWRMT_NOTIFICATION_OTA_CHUNK_BITMAP = 0x97,
+    SWRMT_NOTIFICATION_OTA_PAGE_HASHES = 0x98,
+    SWRMT_NOTIFICATION_LOG_RECORDS = 0x99,
 } swrmt_notification_type_t;
 
 /// Protocol packet type
@@ -77,13 +98,33 @@ typedef struct __attribute__((packed)) {
 typedef struct __attribute__((packed)) {
     uint32_t image_size;                        ///< User image size in bytes
     uint32_t chunk_count;
+    uint8_t  ack_interval;                      ///< 0 to ack each chunk, otherwise send a chunk bitmap every ack_interval chunks
+    uint8_t  mode;                              ///< Encoding of the chunks (swrmt_ota_mode_t)
+    uint32_t base_size;                         ///< Size of the installed image the delta patch applies to
+    uint8_t  base_hash[8];                      ///< First bytes of the SHA256 of the installed image
+    uint8_t  pages[SWRMT_OTA_PAGES_BITMAP_SIZE];///< Bitmap of the image pages to erase and program
+    uint8_t  chunk_size;                        ///< Size of all chunks but the last one
+    uint8_t  image_hash[SWRMT_IMAGE_HASH_LENGTH];   ///< First bytes of the SHA256 of the new image
+    uint8_t  stage;                             ///< 1 when running devices must stage the image, they ignore the request otherwise
 } swrmt_ota_start_pkt_t;
 
 typedef struct __attribute__((packed)) {
-    uint32_t index;                             ///< Index of the chunk
+    uint8_t  first_page;                        ///< Index of the first page, relative to the image start
+    uint8_t  page_count;                        ///< Number of pages to hash
+    uint32_t size;                              ///< Hashes don't cover bytes after size (e.g. end of image)
+} swrmt_ota_page_hashes_request_pkt_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t heartbeat_ms;                      ///< Maximum interval between two status notifications
+    uint16_t battery_delta;                     ///< Battery level change in mV sending a notification, 0 to ignore the battery
+    uint32_t position_delta;                    ///< Position change on one axis sending a notification, 0 to ignore the position
+} swrmt_status_policy_pkt_t;
+
+typedef struct __attribute__((packed)) {
+    uint32_t index;                             ///< Index of the chunk, generation (high 16 bits) and coefficients (low 16 bits) of fountain symbols
     uint8_t  chunk_size;                        ///< Size of the chunk
-    uint8_t  sha[8];
-    uint8_t  chunk[SWRMT_OTA_CHUNK_SIZE];       ///< Bytes array of the firmware chunk
+    uint8_t  sha[8];                            ///< First bytes of the SHA256 of the chunk
+    uint8_t  chunk[SWRMT_OTA_CHUNK_SIZE_MAX];   ///< Bytes array of the firmware chunk
 } swrmt_ota_chunk_pkt_t;
 
 typedef struct __attribute__((packed)) {
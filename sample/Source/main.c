@@ -24,16 +24,17 @@ typedef struct __attribute__((packed)) {
 } msg_packet_t;
 
 void swarmit_keep_alive(void);
-void swarmit_send_data_packet(const uint8_t *packet, uint8_t length);
+uint8_t swarmit_send_data_packet(const uint8_t *packet, uint8_t length);
 void swarmit_ipc_isr(ipc_isr_cb_t cb);
 void swarmit_log_data(uint8_t *data, size_t length);
+bool swarmit_log_record(const char *fmt, const uint32_t *args, size_t count);
 static bool _timer_running = false;
 
 static void _rx_data_callback(const uint8_t *data, size_t length) {
     (void)length;
-    msg_packet_t *msg = (msg_packet_t *)(data);
-    msg->content[msg->length] = 0;
-    printf("Message (type: %02X) received (%dB): %s\n", msg->type, msg->length, (char *)msg->content);
+    // The packet is read in place, it must not be modified
+    const msg_packet_t *msg = (const msg_packet_t *)(data);
+    printf("Message (type: %02X) received (%dB): %.*s\n", msg->type, msg->length, msg->length, (const char *)msg->content);
 }
 
 static void delay_ms(uint32_t ms) {
@@ -56,11 +57,15 @@ int main(void) {
     NVIC_EnableIRQ(TIMER0_IRQn);
     NRF_TIMER0_NS->TASKS_START = 1;
 
+    uint32_t loop_count = 0;
     while (1) {
         delay_ms(500);
         swarmit_keep_alive();
         swarmit_send_data_packet((uint8_t *)"Hello", 5);
         swarmit_log_data((uint8_t *)"Logging", 7);
+        // Only the address of the format string is sent, the controller formats the record from the ELF file
+        uint32_t log_args[] = { loop_count++ };
+        swarmit_log_record("Loop %u\n", log_args, 1);
         // Crash on purpose
         //uint32_t *addr = 0x0;
         //*addr = 0xdead;
@@ -13,14 +13,18 @@ from rich.pretty import pprint
 
 from testbed.swarmit import __version__
 from testbed.swarmit.controller import (
-    CHUNK_SIZE,
     OTA_ACK_TIMEOUT_DEFAULT,
     OTA_MAX_RETRIES_DEFAULT,
+    OTA_WINDOW_DEFAULT,
+    STATUS_BATTERY_DELTA_DEFAULT,
+    STATUS_HEARTBEAT_DEFAULT,
+    STATUS_POSITION_DELTA_DEFAULT,
     Controller,
     ControllerSettings,
     ResetLocation,
     print_transfer_status,
 )
+from testbed.swarmit.protocol import OtaMode
 
 SERIAL_PORT_DEFAULT = get_default_port()
 BAUDRATE_DEFAULT = 1000000
@@ -240,9 +244,53 @@ def reset(ctx, locations):
     show_default=True,
     help="Number of retries for each OTA message (start or chunk) transfer.",
 )
+@click.option(
+    "-w",
+    "--ota-window",
+    type=int,
+    default=OTA_WINDOW_DEFAULT,
+    show_default=True,
+    help="Number of OTA chunks in flight per device before waiting for ACKs.",
+)
+@click.option(
+    "-z",
+    "--compress",
+    is_flag=True,
+    help="Compress the firmware, the devices decompress it while flashing.",
+)
+@click.option(
+    "-f",
+    "--fountain",
+    is_flag=True,
+    help="Broadcast fountain coded chunks without ACKs (no device selected).",
+)
+@click.option(
+    "-S",
+    "--stage",
+    is_flag=True,
+    help="Also flash running devices, the firmware is installed when they are stopped.",
+)
+@click.option(
+    "-b",
+    "--base",
+    type=click.File(mode="rb"),
+    help="Firmware installed on the robots, only a delta patch is sent.",
+)
 @click.argument("firmware", type=click.File(mode="rb"), required=False)
 @click.pass_context
-def flash(ctx, yes, start, ota_timeout, ota_max_retries, firmware):
+def flash(
+    ctx,
+    yes,
+    start,
+    ota_timeout,
+    ota_max_retries,
+    ota_window,
+    compress,
+    fountain,
+    stage,
+    base,
+    firmware,
+):
     """Flash a firmware to the robots."""
     console = Console()
     if firmware is None:
@@ -250,20 +298,46 @@ def flash(ctx, yes, start, ota_timeout, ota_max_retries, firmware):
         ctx.exit()
     ctx.obj["settings"].ota_timeout = ota_timeout
     ctx.obj["settings"].ota_max_retries = ota_max_retries
+    ctx.obj["settings"].ota_window = ota_window
+    ctx.obj["settings"].ota_compress = compress
+    ctx.obj["settings"].ota_fountain = fountain
+    ctx.obj["settings"].ota_stage = stage
     fw = bytearray(firmware.read())
     controller = Controller(ctx.obj["settings"])
-    if not controller.ready_devices:
+    devices_to_flash = controller.flashable_devices
+    if not devices_to_flash:
         console.print("[bold red]Error:[/] No ready device found. Exiting.")
         controller.terminate()
         return
-    print(
-        f"Devices to flash ([bold white]{len(controller.ready_devices)}):[/]"
-    )
-    pprint(controller.ready_devices, expand_all=True)
+    up_to_date_devices = controller.up_to_date_devices(fw)
+    if up_to_date_devices:
+        print(
+            "Devices already running this firmware "
+            f"([bold white]{len(up_to_date_devices)}):[/]"
+        )
+        pprint(up_to_date_devices, expand_all=True)
+    devices_to_flash = [
+        addr for addr in devices_to_flash if addr not in up_to_date_devices
+    ]
+    if not devices_to_flash:
+        print("[bold]All devices already run this firmware[/]")
+        if start is True:
+            controller.start()
+        controller.terminate()
+        return
+    staging_devices = [
+        addr
+        for addr in (controller.staging_devices if stage else [])
+        if addr in devices_to_flash
+    ]
+    print(f"Devices to flash ([bold white]{len(devices_to_flash)}):[/]")
+    pprint(devices_to_flash, expand_all=True)
     if yes is False:
         click.confirm("Do you want to continue?", default=True, abort=True)
 
-    start_data = controller.start_ota(fw)
+    start_data = controller.start_ota(
+        fw, bytearray(base.read()) if base is not None else None
+    )
     if controller.settings.verbose:
         print("\n[b]Start OTA response:[/]")
         pprint(start_data, indent_guides=False, expand_all=True)
@@ -274,16 +348,29 @@ def flash(ctx, yes, start, ota_timeout, ota_max_retries, firmware):
             f"are missing ({', '.join(sorted(set(start_data['missed'])))}). "
             "Aborting."
         )
+        if start_data["ota"].mode & OtaMode.Delta:
+            console.print(
+                "Devices only acknowledge a delta patch of their installed "
+                "image, check the base firmware or flash without it."
+            )
         controller.stop()
         controller.terminate()
         raise click.Abort()
     print()
     print(f"Image size: [bold cyan]{len(fw)}B[/]")
+    if start_data["ota"].mode != OtaMode.Raw:
+        transfer_size = sum(chunk.size for chunk in controller.chunks)
+        print(
+            f"Transfer size ({start_data['ota'].mode.name}): "
+            f"[bold cyan]{transfer_size}B[/] "
+            f"({100 * transfer_size / len(fw):.1f}%)"
+        )
     print(
         f"Image hash: [bold cyan]{start_data['ota'].fw_hash.hex().upper()}[/]"
     )
     print(
-        f"Radio chunks ([bold]{CHUNK_SIZE}B[/bold]): {start_data['ota'].chunks}"
+        f"Radio chunks ([bold]{start_data['ota'].chunk_size}B[/bold]): "
+        f"{start_data['ota'].chunks}"
     )
     start_time = time.time()
     data = controller.transfer(fw, start_data["acked"])
@@ -298,16 +385,31 @@ def flash(ctx, yes, start, ota_timeout, ota_max_retries, firmware):
         console.print("[bold red]Error:[/] Transfer failed.")
         raise click.Abort()
 
+    if staging_devices:
+        print(
+            f"Firmware staged on {len(staging_devices)} running devices, "
+            "installed when they are stopped"
+        )
     if start is True:
+        if staging_devices and not controller.install_staged(staging_devices):
+            console.print("[bold red]Error:[/] Staged firmware not installed.")
         time.sleep(1)
         controller.start()
     controller.terminate()
 
 
 @main.command()
+@click.option(
+    "-e",
+    "--elf",
+    type=click.File(mode="rb"),
+    help="ELF file of the user image, used to format the binary log records.",
+)
 @click.pass_context
-def monitor(ctx):
+def monitor(ctx, elf):
     """Monitor running applications."""
+    if elf is not None:
+        ctx.obj["settings"].log_elf = elf.read()
     try:
         controller = Controller(ctx.obj["settings"])
     except (
@@ -334,6 +436,39 @@ def status(ctx):
     controller.terminate()
 
 
+@main.command()
+@click.option(
+    "-t",
+    "--heartbeat",
+    type=int,
+    default=STATUS_HEARTBEAT_DEFAULT,
+    show_default=True,
+    help="Maximum interval in ms between two status notifications.",
+)
+@click.option(
+    "-b",
+    "--battery-delta",
+    type=int,
+    default=STATUS_BATTERY_DELTA_DEFAULT,
+    show_default=True,
+    help="Battery level change in mV sending a status notification, 0 to ignore.",
+)
+@click.option(
+    "-p",
+    "--position-delta",
+    type=int,
+    default=STATUS_POSITION_DELTA_DEFAULT,
+    show_default=True,
+    help="Position change (1e-6 units) sending a status notification, 0 to ignore.",
+)
+@click.pass_context
+def status_policy(ctx, heartbeat, battery_delta, position_delta):
+    """Set when the robots send their status."""
+    controller = Controller(ctx.obj["settings"])
+    controller.set_status_policy(heartbeat, battery_delta, position_delta)
+    controller.terminate()
+
+
 @main.command()
 @click.argument("message", type=str, required=True)
 @click.pass_context
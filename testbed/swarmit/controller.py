@@ -21,26 +21,58 @@ from testbed.swarmit.adapter import (
     MarilibCloudAdapter,
     MarilibEdgeAdapter,
 )
+from testbed.swarmit.delta import diff
+from testbed.swarmit.fountain import (
+    FOUNTAIN_GENERATION_SIZE,
+    encode,
+    generation_count,
+    random_coefficients,
+    symbol_index,
+)
+from testbed.swarmit.log import LogDecoder, parse_events
+from testbed.swarmit.lz import compress
 from testbed.swarmit.protocol import (
     DeviceType,
+    OtaMode,
     PayloadMessage,
     PayloadOTAChunkRequest,
+    PayloadOTAPageHashesRequest,
     PayloadOTAStartRequest,
+    PayloadOTAStatusRequest,
     PayloadResetRequest,
     PayloadStartRequest,
+    PayloadStatusPolicyRequest,
+    PayloadStatusRequest,
     PayloadStopRequest,
     StatusType,
     SwarmitPayloadType,
     register_parsers,
 )
 
-CHUNK_SIZE = 128
 COMMAND_TIMEOUT = 6
 COMMAND_MAX_ATTEMPTS = 5
 COMMAND_ATTEMPT_DELAY = 0.7
 STATUS_TIMEOUT = 5
+STATUS_HEARTBEAT_DEFAULT = (
+    2000  # ms, max interval between status notifications
+)
+STATUS_BATTERY_DELTA_DEFAULT = 50  # mV
+STATUS_POSITION_DELTA_DEFAULT = 50000  # Position units are 1e-6
 OTA_MAX_RETRIES_DEFAULT = 10
 OTA_ACK_TIMEOUT_DEFAULT = 0.7
+OTA_WINDOW_DEFAULT = 8
+OTA_CHUNK_SIZE_MIN = 128  # Smallest chunk size accepted by the devices
+OTA_CHUNK_SIZE_MAX = 220  # Largest chunk fitting in a Mari payload
+OTA_FOUNTAIN_REDUNDANCY_DEFAULT = 1.25  # Symbols sent per generation chunk
+OTA_FOUNTAIN_REDUNDANCY_FACTOR = 1.5  # Redundancy increase per round
+OTA_FOUNTAIN_REDUNDANCY_MAX = 4
+OTA_FOUNTAIN_EXTRA_SYMBOLS = 2  # Covers the linearly dependent symbols
+OTA_PAGE_SIZE = 4096
+OTA_PAGE_HASH_LENGTH = 8
+OTA_PAGE_HASHES_MAX = 28  # Max page hashes per notification
+OTA_PAGES_BITMAP_SIZE = 30
+OTA_IMAGE_HASH_LENGTH = 8
+OTA_INSTALL_TIMEOUT = 30  # Reboot and copy of the staged pages
 SERIAL_PORT_DEFAULT = get_default_port()
 BROADCAST_ADDRESS = 0xFFFFFFFFFFFFFFFF
 VOLTAGE_MAX = 3000  # mV
@@ -57,6 +89,8 @@ class NodeStatus:
     battery: int = 0
     pos_x: int = 0
     pos_y: int = 0
+    image_hash: bytes = bytes(OTA_IMAGE_HASH_LENGTH)
+    rx_dropped: int = 0
 
 
 @dataclass
@@ -77,6 +111,15 @@ class StartOtaData:
     fw_hash: bytes = b""
     addrs: list[str] = dataclasses.field(default_factory=lambda: [])
     retries: int = 0
+    ack_interval: int = 0
+    mode: OtaMode = OtaMode.Raw
+    base_size: int = 0
+    base_hash: bytes = bytes(8)
+    pages: list[int] = dataclasses.field(default_factory=lambda: [])
+    chunk_size: int = OTA_CHUNK_SIZE_MAX
+    chunk_sizes_max: dict[str, int] = dataclasses.field(
+        default_factory=lambda: {}
+    )
 
 
 @dataclass
@@ -100,6 +143,16 @@ class TransferDataStatus:
     success: bool = False
 
 
+@dataclass
+class ChunkWindow:
+    """Class that holds the chunks in flight to a single destination."""
+
+    in_flight: dict[int, float] = dataclasses.field(default_factory=dict)
+    retries: dict[int, int] = dataclasses.field(default_factory=dict)
+    status_requested: set[int] = dataclasses.field(default_factory=set)
+    next_chunk: int = 0
+
+
 @dataclass
 class ResetLocation:
     """Class that holds reset location."""
@@ -155,6 +208,16 @@ def generate_status(status_data, devices=[], status_message="found"):
         style="cyan",
         justify="center",
     )
+    table.add_column(
+        "Image",
+        style="cyan",
+        justify="center",
+    )
+    table.add_column(
+        "RX drops",
+        style="cyan",
+        justify="center",
+    )
     table.add_column(
         "Status",
         style="green",
@@ -168,6 +231,8 @@ def generate_status(status_data, devices=[], status_message="found"):
             f"{device_data.device.name}",
             f"[{battery_level_color(device_data.battery)}]{device_data.battery / 1000:.2f}V ({int(device_data.battery / 3000 * 100)}%)",
             f"({(device_data.pos_x / 1e6):.2f}, {(device_data.pos_y / 1e6):.2f})",
+            f"{device_data.image_hash.hex().upper() if any(device_data.image_hash) else '-'}",
+            f"{device_data.rx_dropped}",
             f"{'[bold cyan]' if device_data.status == StatusType.Running else '[bold green]'}{device_data.status.name}",
         )
     return Group(header, table)
@@ -221,6 +286,11 @@ class ControllerSettings:
     devices: list[str] = dataclasses.field(default_factory=lambda: [])
     ota_max_retries: int = OTA_MAX_RETRIES_DEFAULT
     ota_timeout: float = OTA_ACK_TIMEOUT_DEFAULT
+    ota_window: int = OTA_WINDOW_DEFAULT
+    ota_compress: bool = False
+    ota_fountain: bool = False
+    ota_stage: bool = False
+    log_elf: bytes = b""  # User image ELF file, formats the binary log records
     verbose: bool = False
 
 
@@ -235,9 +305,13 @@ class Controller:
         self.started_data: list[str] = []
         self.stopped_data: list[str] = []
         self.chunks: list[DataChunk] = []
+        self.chunks_to_send: list[DataChunk] = []
+        self.page_hashes_data: dict[str, dict[int, bytes]] = {}
+        self.bitmap_devices: set[str] = set()
         self.start_ota_data: StartOtaData = StartOtaData()
         self.transfer_data: dict[str, TransferDataStatus] = {}
         self._known_devices: dict[str, StatusType] = {}
+        self.log_decoder = LogDecoder(self.settings.log_elf)
         register_parsers()
         if self.settings.adapter == "cloud":
             self._interface = MarilibCloudAdapter(
@@ -259,6 +333,7 @@ class Controller:
     def known_devices(self) -> dict[str, StatusType]:
         """Return the known devices."""
         if not self._known_devices:
+            self._request_status()
             wait_for_done(COMMAND_TIMEOUT, lambda: False)
             self._known_devices = self.status_data
         return self._known_devices
@@ -310,6 +385,32 @@ class Controller:
             )
         ]
 
+    @property
+    def staging_devices(self) -> list[str]:
+        """Return the running devices that can stage a new image."""
+        return [
+            device_addr
+            for device_addr, node in self.known_devices.items()
+            if (
+                node.status == StatusType.Running
+                and (
+                    not self.settings.devices
+                    or device_addr in self.settings.devices
+                )
+            )
+        ]
+
+    @property
+    def flashable_devices(self) -> list[str]:
+        """Return the devices to flash.
+
+        Running devices stage the image while their application keeps
+        running, it is installed at their next start.
+        """
+        if self.settings.ota_stage:
+            return self.ready_devices + self.staging_devices
+        return self.ready_devices
+
     @property
     def interface(self) -> GatewayAdapterBase:
         """Return the interface."""
@@ -341,13 +442,22 @@ class Controller:
                 battery=packet.payload.battery,
                 pos_x=packet.payload.pos_x,
                 pos_y=packet.payload.pos_y,
+                image_hash=bytes(packet.payload.image_hash),
+                rx_dropped=packet.payload.rx_dropped,
             )
             self.status_data.update({device_addr: status})
         elif (
             packet.payload_type
             == SwarmitPayloadType.SWARMIT_NOTIFICATION_OTA_START_ACK
         ):
-            if device_addr in self.start_ota_data.addrs:
+            self.start_ota_data.chunk_sizes_max[device_addr] = (
+                packet.payload.chunk_size_max
+            )
+            # Devices reject chunks larger than they support
+            if (
+                packet.payload.chunk_size_max < self.start_ota_data.chunk_size
+                or device_addr in self.start_ota_data.addrs
+            ):
                 return
             self.start_ota_data.addrs.append(device_addr)
         elif (
@@ -371,6 +481,35 @@ class Controller:
                 self.transfer_data[device_addr].chunks[
                     packet.payload.index
                 ].acked = 1
+        elif (
+            packet.payload_type
+            == SwarmitPayloadType.SWARMIT_NOTIFICATION_OTA_CHUNK_BITMAP
+        ):
+            if device_addr not in self.transfer_data:
+                return
+            self.bitmap_devices.add(device_addr)
+            chunks = self.transfer_data[device_addr].chunks
+            base = min(packet.payload.base, len(chunks))
+            for index in range(base):
+                chunks[index].acked = 1
+            for byte_index, byte in enumerate(packet.payload.bitmap):
+                for bit in range(8):
+                    index = base + byte_index * 8 + bit
+                    if index < len(chunks) and byte & (1 << bit):
+                        chunks[index].acked = 1
+        elif (
+            packet.payload_type
+            == SwarmitPayloadType.SWARMIT_NOTIFICATION_OTA_PAGE_HASHES
+        ):
+            page_hashes = self.page_hashes_data.setdefault(device_addr, {})
+            for offset in range(0, packet.payload.count, OTA_PAGE_HASH_LENGTH):
+                page_hashes[
+                    packet.payload.first_page + offset // OTA_PAGE_HASH_LENGTH
+                ] = bytes(
+                    packet.payload.hashes[
+                        offset : offset + OTA_PAGE_HASH_LENGTH
+                    ]
+                )
         elif packet.payload_type in [
             SwarmitPayloadType.SWARMIT_NOTIFICATION_EVENT_GPIO,
             SwarmitPayloadType.SWARMIT_NOTIFICATION_EVENT_LOG,
@@ -383,20 +522,46 @@ class Controller:
             logger = self.logger.bind(
                 device_addr=device_addr,
                 notification=SwarmitPayloadType(packet.payload_type).name,
-                timestamp=packet.payload.timestamp,
-                data_size=packet.payload.count,
-                data=packet.payload.data,
             )
             if (
                 packet.payload_type
                 == SwarmitPayloadType.SWARMIT_NOTIFICATION_EVENT_GPIO
             ):
-                logger.info("GPIO event")
+                logger.info(
+                    "GPIO event",
+                    timestamp=packet.payload.timestamp,
+                    data_size=packet.payload.count,
+                    data=packet.payload.data,
+                )
             elif (
                 packet.payload_type
                 == SwarmitPayloadType.SWARMIT_NOTIFICATION_EVENT_LOG
             ):
-                logger.info("LOG event")
+                for timestamp, data in parse_events(
+                    packet.payload.timestamp, packet.payload.data
+                ):
+                    logger.info(
+                        "LOG event",
+                        timestamp=timestamp,
+                        data_size=len(data),
+                        data=data,
+                    )
+        elif (
+            packet.payload_type
+            == SwarmitPayloadType.SWARMIT_NOTIFICATION_LOG_RECORDS
+        ):
+            if (
+                self.settings.devices
+                and device_addr not in self.settings.devices
+            ):
+                return
+            logger = self.logger.bind(
+                device_addr=device_addr,
+                notification=SwarmitPayloadType(packet.payload_type).name,
+                timestamp=packet.payload.timestamp,
+            )
+            for message in self.log_decoder.decode(packet.payload.data):
+                logger.info("LOG record", message=message)
         elif packet.payload_type == SwarmitPayloadType.METRICS_PROBE:
             pass
         else:
@@ -404,10 +569,15 @@ class Controller:
                 "Unknown payload type", payload_type=packet.payload_type
             )
 
+    def _request_status(self):
+        """Ask the devices to send their status without waiting for a change."""
+        self.send_payload(BROADCAST_ADDRESS, PayloadStatusRequest())
+
     def _live_status(
         self, devices=[], timeout=STATUS_TIMEOUT, message="found"
     ):
         """Request the live status of the testbed."""
+        self._request_status()
         with Live(
             generate_status(self.status_data, devices, status_message=message),
             refresh_per_second=4,
@@ -479,6 +649,28 @@ class Controller:
             stoppable_devices, timeout=COMMAND_TIMEOUT, message="to stop"
         )
 
+    def install_staged(self, devices: list[str]) -> bool:
+        """Stop the devices that staged an image so they install it."""
+        self.stop()
+        return wait_for_done(
+            OTA_INSTALL_TIMEOUT,
+            lambda: all(
+                self.status_data[addr].status == StatusType.Bootloader
+                for addr in devices
+            ),
+        )
+
+    def up_to_date_devices(self, firmware: bytes) -> list[str]:
+        """Return the devices to flash that already run the firmware."""
+        digest = hashes.Hash(hashes.SHA256())
+        digest.update(firmware)
+        image_hash = digest.finalize()[:OTA_IMAGE_HASH_LENGTH]
+        return [
+            addr
+            for addr in self.flashable_devices
+            if self.status_data[addr].image_hash == image_hash
+        ]
+
     def _send_reset(self, device_addr: int, location: ResetLocation):
         payload = PayloadResetRequest(
             pos_x=location.pos_x,
@@ -510,6 +702,24 @@ class Controller:
         )
         self.send_payload(device_addr, payload)
 
+    def set_status_policy(
+        self,
+        heartbeat: int = STATUS_HEARTBEAT_DEFAULT,
+        battery_delta: int = STATUS_BATTERY_DELTA_DEFAULT,
+        position_delta: int = STATUS_POSITION_DELTA_DEFAULT,
+    ):
+        """Set when the devices send their status."""
+        payload = PayloadStatusPolicyRequest(
+            heartbeat=heartbeat,
+            battery_delta=battery_delta,
+            position_delta=position_delta,
+        )
+        if not self.settings.devices:
+            self.send_payload(BROADCAST_ADDRESS, payload)
+        else:
+            for addr in self.settings.devices:
+                self.send_payload(int(addr, 16), payload)
+
     def send_message(self, message):
         """Send a message to the devices."""
         running_devices = self.running_devices
@@ -522,75 +732,248 @@ class Controller:
                 self._send_message(int(addr, 16), message)
 
     def _send_start_ota(
-        self, device_addr: str, devices_to_flash: set[str], firmware: bytes
+        self,
+        destinations: list[str],
+        devices_to_flash: set[str],
+        firmware: bytes,
     ):
-        def is_start_ota_acknowledged():
+        """Send the start request to all destinations until acknowledged."""
+
+        def is_start_ota_acknowledged(device_addr):
+            answered = self.start_ota_data.chunk_sizes_max.keys()
             if int(device_addr, 16) == BROADCAST_ADDRESS:
-                return sorted(self.start_ota_data.addrs) == sorted(
-                    devices_to_flash
-                )
+                return sorted(answered) == sorted(devices_to_flash)
             else:
-                return device_addr in self.start_ota_data.addrs
+                return device_addr in answered
 
+        pages = bytearray(OTA_PAGES_BITMAP_SIZE)
+        for page in self.start_ota_data.pages:
+            pages[page // 8] |= 1 << (page % 8)
         payload = PayloadOTAStartRequest(
             fw_length=len(firmware),
             fw_chunk_count=len(self.chunks),
+            ack_interval=self.start_ota_data.ack_interval,
+            mode=self.start_ota_data.mode.value,
+            base_size=self.start_ota_data.base_size,
+            base_hash=self.start_ota_data.base_hash,
+            pages=bytes(pages),
+            chunk_size=self.start_ota_data.chunk_size,
+            image_hash=self.start_ota_data.fw_hash[:OTA_IMAGE_HASH_LENGTH],
+            stage=int(self.settings.ota_stage),
         )
-        send_time = time.time()
-        send = True
-        while (
-            not is_start_ota_acknowledged()
-            and self.start_ota_data.retries <= self.settings.ota_max_retries
-        ):
-            if send is True:
-                self.send_payload(int(device_addr, 16), payload)
-                send_time = time.time()
+        # Requests to all destinations are in flight at the same time
+        send_times = {addr: 0.0 for addr in destinations}
+        retries = {addr: 0 for addr in destinations}
+        while True:
+            pending = [
+                addr
+                for addr in destinations
+                if not is_start_ota_acknowledged(addr)
+                and retries[addr] <= self.settings.ota_max_retries
+            ]
+            if not pending:
+                break
+            for addr in pending:
+                if time.time() - send_times[addr] <= self.settings.ota_timeout:
+                    continue
+                self.send_payload(int(addr, 16), payload)
+                send_times[addr] = time.time()
+                retries[addr] += 1
                 self.start_ota_data.retries += 1
             time.sleep(0.001)
-            send = time.time() - send_time > self.settings.ota_timeout
 
-    def start_ota(self, firmware) -> StartOtaData:
-        """Start the OTA process."""
-        self.start_ota_data = StartOtaData()
+    def _query_page_hashes(self, size: int, devices_to_flash: list[str]):
+        """Collect the hashes of the image pages currently in flash."""
+        self.page_hashes_data = {}
+        pages_count = (size + OTA_PAGE_SIZE - 1) // OTA_PAGE_SIZE
+        for first_page in range(0, pages_count, OTA_PAGE_HASHES_MAX):
+            payload = PayloadOTAPageHashesRequest(
+                first_page=first_page,
+                page_count=min(OTA_PAGE_HASHES_MAX, pages_count - first_page),
+                size=size,
+            )
+
+            def missing_devices():
+                return [
+                    addr
+                    for addr in devices_to_flash
+                    if first_page not in self.page_hashes_data.get(addr, {})
+                ]
+
+            for _ in range(COMMAND_MAX_ATTEMPTS):
+                if not missing_devices():
+                    break
+                if not self.settings.devices:
+                    self.send_payload(BROADCAST_ADDRESS, payload)
+                else:
+                    for addr in missing_devices():
+                        self.send_payload(int(addr, 16), payload)
+                wait_for_done(
+                    COMMAND_ATTEMPT_DELAY, lambda: not missing_devices()
+                )
+
+    def _changed_pages(
+        self, firmware: bytes, devices_to_flash: list[str]
+    ) -> list[int]:
+        """Return the image pages that differ on at least one device."""
+        self._query_page_hashes(len(firmware), devices_to_flash)
+        pages = []
+        for page, offset in enumerate(range(0, len(firmware), OTA_PAGE_SIZE)):
+            page_digest = hashes.Hash(hashes.SHA256())
+            page_digest.update(firmware[offset : offset + OTA_PAGE_SIZE])
+            page_hash = page_digest.finalize()[:OTA_PAGE_HASH_LENGTH]
+            # Devices that didn't answer get all pages
+            if any(
+                self.page_hashes_data.get(addr, {}).get(page) != page_hash
+                for addr in devices_to_flash
+            ):
+                pages.append(page)
+        return pages
+
+    def _encode(self, firmware: bytes, base, chunk_size: int):
+        """Return the encoding mode and chunks of the image."""
+        stream = firmware
+        mode = OtaMode.Raw
+        if base:
+            stream = diff(base, firmware)
+            mode = OtaMode.Delta
+        blocks = [
+            stream[index : index + chunk_size]
+            for index in range(0, len(stream), chunk_size)
+        ]
+        if self.settings.ota_compress or base:
+            # Delta patches are always compressed, ADD diffs are mostly zeros
+            compressed_blocks = compress(stream, chunk_size)
+            if len(compressed_blocks) < len(blocks):
+                blocks = compressed_blocks
+                mode |= OtaMode.Lz
+        return mode, blocks
+
+    def _prepare_chunks(self, firmware: bytes, base=None):
+        """Split the image in chunks, encoded when it reduces their count."""
+        chunk_size = self.start_ota_data.chunk_size
         self.chunks = []
-        digest = hashes.Hash(hashes.SHA256())
-        chunks_count = int(len(firmware) / CHUNK_SIZE) + int(
-            len(firmware) % CHUNK_SIZE != 0
-        )
-        for chunk_idx in range(chunks_count):
-            if chunk_idx == chunks_count - 1:
-                chunk_size = len(firmware) % CHUNK_SIZE
-            else:
-                chunk_size = CHUNK_SIZE
-            data = firmware[
-                chunk_idx * CHUNK_SIZE : chunk_idx * CHUNK_SIZE + chunk_size
-            ]
-            digest.update(data)
+        blocks = [
+            firmware[index : index + chunk_size]
+            for index in range(0, len(firmware), chunk_size)
+        ]
+        # Fountain symbols are combinations of raw chunks
+        if self.start_ota_data.mode != OtaMode.Fountain:
+            mode, encoded_blocks = self._encode(firmware, base, chunk_size)
+            # Fall back to raw chunks when encoding doesn't reduce the transfer
+            if len(encoded_blocks) < len(blocks):
+                blocks = encoded_blocks
+                self.start_ota_data.mode = mode
+        if self.start_ota_data.mode & OtaMode.Delta:
+            base_digest = hashes.Hash(hashes.SHA256())
+            base_digest.update(base)
+            self.start_ota_data.base_size = len(base)
+            self.start_ota_data.base_hash = base_digest.finalize()[:8]
+        for chunk_idx, data in enumerate(blocks):
             chunk_sha = hashes.Hash(hashes.SHA256())
             chunk_sha.update(data)
             self.chunks.append(
                 DataChunk(
                     index=chunk_idx,
-                    size=chunk_size,
+                    size=len(data),
                     sha=chunk_sha.finalize()[
                         :8
                     ],  # the first 8 bytes should be enough
                     data=data,
                 )
             )
-        self.start_ota_data.fw_hash = digest.finalize()
         self.start_ota_data.chunks = len(self.chunks)
-        devices_to_flash = self.ready_devices
-        if not self.settings.devices:
-            print("Broadcast start ota notification...")
-            self._send_start_ota(
-                addr_to_hex(BROADCAST_ADDRESS), devices_to_flash, firmware
+
+    def start_ota(self, firmware, base=None) -> StartOtaData:
+        """Start the OTA process.
+
+        When base is the image currently installed on the devices, only a
+        delta patch between base and firmware is transferred. Chunks are as
+        large as supported by all devices. Devices that already run the
+        firmware are skipped.
+        """
+        digest = hashes.Hash(hashes.SHA256())
+        digest.update(firmware)
+        fw_hash = digest.finalize()
+        # Devices don't acknowledge an image they already run
+        up_to_date_devices = self.up_to_date_devices(firmware)
+        devices_to_flash = [
+            addr
+            for addr in self.flashable_devices
+            if addr not in up_to_date_devices
+        ]
+        if not devices_to_flash:
+            self.start_ota_data = StartOtaData(fw_hash=fw_hash)
+            return {
+                "ota": self.start_ota_data,
+                "acked": [],
+                "missed": [],
+                "skipped": sorted(up_to_date_devices),
+            }
+        pages_count = (len(firmware) + OTA_PAGE_SIZE - 1) // OTA_PAGE_SIZE
+        changed_pages = None
+        chunk_size = OTA_CHUNK_SIZE_MAX
+        while True:
+            self.start_ota_data = StartOtaData(
+                fw_hash=fw_hash, chunk_size=chunk_size
             )
-        else:
-            for addr in devices_to_flash:
-                print(f"Sending start ota notification to {addr}...")
-                self._send_start_ota(addr, devices_to_flash, firmware)
-                time.sleep(0.2)
+            if self.settings.ota_fountain and not self.settings.devices:
+                self.start_ota_data.mode = OtaMode.Fountain
+            self._prepare_chunks(firmware, base)
+            self.start_ota_data.pages = list(range(pages_count))
+            self.chunks_to_send = self.chunks
+            if self.start_ota_data.mode == OtaMode.Raw:
+                # Only the chunks of pages that changed are programmed
+                if changed_pages is None:
+                    changed_pages = self._changed_pages(
+                        firmware, devices_to_flash
+                    )
+                self.start_ota_data.pages = changed_pages
+                self.chunks_to_send = [
+                    chunk
+                    for chunk in self.chunks
+                    if (chunk.index * chunk_size) // OTA_PAGE_SIZE
+                    in changed_pages
+                    or ((chunk.index + 1) * chunk_size - 1) // OTA_PAGE_SIZE
+                    in changed_pages
+                ]
+            if not self.settings.devices:
+                # Broadcast acks are cumulative, to avoid one ack per chunk
+                # and per device competing with the chunks for the downlink
+                # slots. Fountain symbols are not acknowledged.
+                if self.start_ota_data.mode != OtaMode.Fountain:
+                    self.start_ota_data.ack_interval = max(
+                        1, self.settings.ota_window // 2
+                    )
+                print("Broadcast start ota notification...")
+                self._send_start_ota(
+                    [addr_to_hex(BROADCAST_ADDRESS)],
+                    devices_to_flash,
+                    firmware,
+                )
+            else:
+                print(
+                    "Sending start ota notification to "
+                    f"{', '.join(devices_to_flash)}..."
+                )
+                self._send_start_ota(
+                    devices_to_flash, devices_to_flash, firmware
+                )
+            chunk_size_max = min(
+                self.start_ota_data.chunk_sizes_max.values(),
+                default=chunk_size,
+            )
+            chunk_size_max -= chunk_size_max % 4
+            if (
+                chunk_size_max >= chunk_size
+                or chunk_size_max < OTA_CHUNK_SIZE_MIN
+            ):
+                break
+            # Start again with the largest chunks supported by all devices.
+            # Current firmware always advertises OTA_CHUNK_SIZE_MAX, this only
+            # runs with devices that advertise a smaller size.
+            print(f"Chunk size reduced to {chunk_size_max}B")
+            chunk_size = chunk_size_max
         return {
             "ota": self.start_ota_data,
             "acked": sorted(self.start_ota_data.addrs),
@@ -599,82 +982,274 @@ class Controller:
                     set(self.start_ota_data.addrs)
                 )
             ),
+            "skipped": sorted(up_to_date_devices),
         }
 
+    def is_chunk_acknowledged(
+        self, chunk_index: int, device_addr: str, devices_to_flash: set[str]
+    ) -> bool:
+        """Return True if the chunk was acked by its destination(s)."""
+        if int(device_addr, 16) == BROADCAST_ADDRESS:
+            return sorted(self.transfer_data.keys()) == sorted(
+                devices_to_flash
+            ) and all(
+                [
+                    status.chunks[chunk_index].acked
+                    for status in self.transfer_data.values()
+                ]
+            )
+        else:
+            return (
+                device_addr in self.transfer_data.keys()
+                and self.transfer_data[device_addr].chunks[chunk_index].acked
+            )
+
     def send_chunk(
         self,
         chunk: DataChunk,
         device_addr: str,
         devices_to_flash: set[str],
+        retries_count: int,
     ):
-        def is_chunk_acknowledged():
-            if int(device_addr, 16) == BROADCAST_ADDRESS:
-                return sorted(self.transfer_data.keys()) == sorted(
-                    devices_to_flash
-                ) and all(
-                    [
-                        status.chunks[chunk.index].acked
-                        for status in self.transfer_data.values()
-                    ]
-                )
-            else:
-                return (
-                    device_addr in self.transfer_data.keys()
-                    and self.transfer_data[device_addr]
-                    .chunks[chunk.index]
-                    .acked
-                )
-
+        """Send a single chunk, without waiting for its acknowledgment."""
+        if self.settings.verbose:
+            missing_acks = [
+                addr
+                for addr in devices_to_flash
+                if addr not in self.transfer_data
+                or not self.transfer_data[addr].chunks[chunk.index].acked
+            ]
+            print(
+                f"Transferring chunk {chunk.index}/{self.start_ota_data.chunks} to {device_addr} "
+                f"- {retries_count} retries "
+                f"- {len(missing_acks)} missing acks: {', '.join(missing_acks) if missing_acks else 'none'}"
+            )
         payload = PayloadOTAChunkRequest(
             index=chunk.index,
             count=chunk.size,
             sha=chunk.sha,
             chunk=chunk.data,
         )
-        send_time = time.time()
-        send = True
-        retries_count = 0
-        while (
-            not is_chunk_acknowledged()
-            and retries_count <= self.settings.ota_max_retries
-        ):
-            if send is True:
-                if self.settings.verbose:
-                    missing_acks = [
-                        addr
-                        for addr in devices_to_flash
-                        if addr not in self.transfer_data
-                        or not self.transfer_data[addr]
-                        .chunks[chunk.index]
-                        .acked
-                    ]
-                    print(
-                        f"Transferring chunk {chunk.index}/{len(self.start_ota_data.chunks)} to {device_addr} "
-                        f"- {retries_count} retries "
-                        f"- {len(missing_acks)} missing acks: {', '.join(missing_acks) if missing_acks else 'none'}"
+        self.send_payload(int(device_addr, 16), payload)
+        if int(device_addr, 16) == BROADCAST_ADDRESS:
+            for addr in devices_to_flash:
+                self.transfer_data[addr].chunks[
+                    chunk.index
+                ].retries = retries_count
+        else:
+            self.transfer_data[device_addr].chunks[
+                chunk.index
+            ].retries = retries_count
+
+    def _service_window(
+        self,
+        device_addr: str,
+        window: ChunkWindow,
+        devices_to_flash: set[str],
+        progress: tqdm = None,
+    ):
+        """Release acked chunks, retransmit lost ones and fill the window."""
+        # Release acknowledged chunks from the window
+        for index in list(window.in_flight.keys()):
+            if self.is_chunk_acknowledged(
+                index, device_addr, devices_to_flash
+            ):
+                del window.in_flight[index]
+                if progress is not None:
+                    progress.update(self.chunks[index].size)
+
+        # Selectively retransmit chunks whose acknowledgment timed out
+        now = time.time()
+        status_request_sent = False
+        for index, send_time in list(window.in_flight.items()):
+            if now - send_time <= self.settings.ota_timeout:
+                continue
+            if (
+                self.start_ota_data.ack_interval
+                and index not in window.status_requested
+            ):
+                # The bitmap may have been lost, ask for it again first
+                if status_request_sent is False:
+                    self.send_payload(
+                        int(device_addr, 16), PayloadOTAStatusRequest()
                     )
-                self.send_payload(int(device_addr, 16), payload)
-                if int(device_addr, 16) == BROADCAST_ADDRESS:
+                    status_request_sent = True
+                window.status_requested.add(index)
+                window.in_flight[index] = now
+                continue
+            window.status_requested.discard(index)
+            if window.retries[index] >= self.settings.ota_max_retries:
+                # Give up on this chunk, transfer status will report it
+                del window.in_flight[index]
+                continue
+            window.retries[index] += 1
+            self.send_chunk(
+                self.chunks[index],
+                device_addr,
+                devices_to_flash,
+                window.retries[index],
+            )
+            window.in_flight[index] = time.time()
+
+        # Fill the window with new chunks
+        while len(window.in_flight) < max(
+            1, self.settings.ota_window
+        ) and window.next_chunk < len(self.chunks_to_send):
+            chunk = self.chunks_to_send[window.next_chunk]
+            window.next_chunk += 1
+            window.retries[chunk.index] = 0
+            self.send_chunk(chunk, device_addr, devices_to_flash, 0)
+            window.in_flight[chunk.index] = time.time()
+
+    def send_chunks(
+        self,
+        destinations: list[str],
+        devices_to_flash: set[str],
+        progress: tqdm = None,
+    ):
+        """Send all chunks with a sliding window of unacknowledged chunks.
+
+        Each destination has its own window of up to `ota_window` chunks in
+        flight and only chunks that were not acked before `ota_timeout` are
+        retransmitted. When acks are cumulative, a first timeout only
+        requests the chunk bitmap of the devices, the chunk is retransmitted
+        on the next one. The windows of all destinations are serviced in the
+        same loop, so devices are flashed concurrently.
+        """
+        windows = {addr: ChunkWindow() for addr in destinations}
+        while any(
+            window.in_flight or window.next_chunk < len(self.chunks_to_send)
+            for window in windows.values()
+        ):
+            for device_addr, window in windows.items():
+                self._service_window(
+                    device_addr, window, devices_to_flash, progress
+                )
+            time.sleep(0.001)
+
+    def _query_chunks_bitmap(self, devices_to_flash: set[str]):
+        """Collect the bitmap of written chunks of the devices."""
+        self.bitmap_devices = set()
+
+        def missing_devices():
+            return set(devices_to_flash).difference(self.bitmap_devices)
+
+        for _ in range(COMMAND_MAX_ATTEMPTS):
+            if not missing_devices():
+                break
+            self.send_payload(BROADCAST_ADDRESS, PayloadOTAStatusRequest())
+            wait_for_done(COMMAND_ATTEMPT_DELAY, lambda: not missing_devices())
+
+    def send_symbols(self, devices_to_flash: set[str], progress: tqdm = None):
+        """Broadcast fountain coded symbols until all devices decoded them.
+
+        Symbols are not acknowledged. Each round sends, for every generation
+        not decoded by all devices, enough symbols to decode it despite lost
+        ones, then collects the chunk bitmaps of the devices. The redundancy
+        increases with the rounds, so the transfer time depends on the worst
+        link loss rate and not on the number of devices.
+        """
+        chunk_size = self.start_ota_data.chunk_size
+        # Keep the same rate as a full window of acknowledged chunks
+        symbol_delay = self.settings.ota_timeout / max(
+            1, self.settings.ota_window
+        )
+        redundancy = OTA_FOUNTAIN_REDUNDANCY_DEFAULT
+        missing = list(range(generation_count(len(self.chunks))))
+        for round_index in range(self.settings.ota_max_retries + 1):
+            for generation in missing:
+                chunks = self.chunks[
+                    generation
+                    * FOUNTAIN_GENERATION_SIZE : (generation + 1)
+                    * FOUNTAIN_GENERATION_SIZE
+                ]
+                for chunk in chunks:
                     for addr in devices_to_flash:
                         self.transfer_data[addr].chunks[
                             chunk.index
-                        ].retries = retries_count
-                else:
-                    self.transfer_data[device_addr].chunks[
-                        chunk.index
-                    ].retries = retries_count
-                send_time = time.time()
-                retries_count += 1
-            time.sleep(0.001)
-            send = time.time() - send_time > self.settings.ota_timeout
+                        ].retries = round_index
+                symbols_count = (
+                    int(len(chunks) * redundancy + 0.5)
+                    + OTA_FOUNTAIN_EXTRA_SYMBOLS
+                )
+                for symbol in range(symbols_count):
+                    # The first round starts with the chunks themselves
+                    if round_index == 0 and symbol < len(chunks):
+                        coefficients = 1 << symbol
+                    else:
+                        coefficients = random_coefficients(len(chunks))
+                    data = encode(
+                        [chunk.data for chunk in chunks],
+                        coefficients,
+                        chunk_size,
+                    )
+                    symbol_sha = hashes.Hash(hashes.SHA256())
+                    symbol_sha.update(data)
+                    if self.settings.verbose:
+                        print(
+                            f"Transferring symbol {symbol}/{symbols_count} "
+                            f"of generation {generation} "
+                            f"(coefficients: {coefficients:04X})"
+                        )
+                    self.send_payload(
+                        BROADCAST_ADDRESS,
+                        PayloadOTAChunkRequest(
+                            index=symbol_index(generation, coefficients),
+                            count=len(data),
+                            sha=symbol_sha.finalize()[:8],
+                            chunk=data,
+                        ),
+                    )
+                    time.sleep(symbol_delay)
+            self._query_chunks_bitmap(devices_to_flash)
+            decoded = [
+                generation
+                for generation in missing
+                if all(
+                    self.transfer_data[addr].chunks[index].acked
+                    for addr in devices_to_flash
+                    for index in range(
+                        generation * FOUNTAIN_GENERATION_SIZE,
+                        min(
+                            (generation + 1) * FOUNTAIN_GENERATION_SIZE,
+                            len(self.chunks),
+                        ),
+                    )
+                )
+            ]
+            if progress is not None:
+                progress.update(
+                    sum(
+                        chunk.size
+                        for chunk in self.chunks
+                        if chunk.index // FOUNTAIN_GENERATION_SIZE in decoded
+                    )
+                )
+            missing = [
+                generation
+                for generation in missing
+                if generation not in decoded
+            ]
+            if not missing:
+                break
+            redundancy = min(
+                OTA_FOUNTAIN_REDUNDANCY_MAX,
+                redundancy * OTA_FOUNTAIN_REDUNDANCY_FACTOR,
+            )
 
     def transfer(self, firmware, devices) -> dict[str, TransferDataStatus]:
         """Transfer the firmware to the devices."""
-        data_size = len(firmware)
+        data_size = sum(chunk.size for chunk in self.chunks_to_send)
         use_progress_bar = not self.settings.verbose
+        destinations = (
+            [addr_to_hex(BROADCAST_ADDRESS)]
+            if not self.settings.devices
+            else devices
+        )
+        progress = None
         if use_progress_bar:
             progress = tqdm(
-                range(0, data_size),
+                range(0, data_size * len(destinations)),
                 unit="B",
                 unit_scale=False,
                 colour="green",
@@ -684,24 +1259,22 @@ class Controller:
                 f"Loading firmware ({int(data_size / 1024)}kB)"
             )
         self.transfer_data = {}
+        indexes_skipped = set(range(len(self.chunks))).difference(
+            chunk.index for chunk in self.chunks_to_send
+        )
         for device_addr in devices:
             self.transfer_data[device_addr] = TransferDataStatus()
             self.transfer_data[device_addr].chunks = [
                 Chunk(index=f"{i:03d}", size=f"{self.chunks[i].size:03d}B")
                 for i in range(len(self.chunks))
             ]
-        for chunk in self.chunks:
-            if not self.settings.devices:
-                self.send_chunk(
-                    chunk,
-                    addr_to_hex(BROADCAST_ADDRESS),
-                    devices,
-                )
-            else:
-                for addr in devices:
-                    self.send_chunk(chunk, addr, devices)
-            if use_progress_bar:
-                progress.update(chunk.size)
+            # Chunks of unchanged pages are already in flash
+            for index in indexes_skipped:
+                self.transfer_data[device_addr].chunks[index].acked = 1
+        if self.start_ota_data.mode == OtaMode.Fountain:
+            self.send_symbols(devices, progress)
+        else:
+            self.send_chunks(destinations, devices, progress)
         if use_progress_bar:
             progress.close()
         for device in devices:
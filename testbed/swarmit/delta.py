@@ -0,0 +1,135 @@
+"""Delta patches of OTA images.
+
+The patch format matches the bootloader patcher (delta.c): a stream of
+COPY, ADD and INSERT operations producing the new image in order. The
+bootloader patches the image in place, one flash page at a time, so an
+operation can't read the installed image before the page being produced.
+"""
+
+DELTA_OP_COPY = 0
+DELTA_OP_ADD = 1
+DELTA_OP_INSERT = 2
+
+DELTA_PAGE_SIZE = 4096
+DELTA_KEY_LENGTH = 8  # Length of the substrings indexed in the base image
+DELTA_MAX_CANDIDATES = 16  # Max number of base positions tested per match
+DELTA_MIN_COPY_LENGTH = 16  # Shorter exact runs are encoded in ADD operations
+DELTA_MAX_MISMATCHES = 16  # Extension stops after this many net mismatches
+
+
+def _is_readable(source: int, position: int) -> bool:
+    """Return True if the base byte at source is still in flash."""
+    return source >= position - position % DELTA_PAGE_SIZE
+
+
+def _header(op: int, length: int, source: int = 0) -> bytes:
+    header = bytes([op]) + length.to_bytes(4, "little")
+    if op != DELTA_OP_INSERT:
+        header += source.to_bytes(4, "little")
+    return header
+
+
+class _Patch:
+    def __init__(self):
+        self.data = bytearray()
+        self.literals = bytearray()
+
+    def insert(self, byte: int):
+        self.literals.append(byte)
+
+    def flush(self):
+        if self.literals:
+            self.data += _header(DELTA_OP_INSERT, len(self.literals))
+            self.data += self.literals
+            self.literals = bytearray()
+
+    def aligned(self, base: bytes, new: bytes, source: int, position: int):
+        """Encode new[position:] against base[source:] until end is reached."""
+        self.flush()
+        diffs = bytes(
+            (new[position + i] - base[source + i]) & 0xFF
+            for i in range(len(new) - position)
+        )
+        index = 0
+        while index < len(diffs):
+            # Exact runs are copied, the rest is added
+            end = index
+            while end < len(diffs) and diffs[end] == 0:
+                end += 1
+            if end - index >= DELTA_MIN_COPY_LENGTH or end == len(diffs):
+                self.data += _header(
+                    DELTA_OP_COPY, end - index, source + index
+                )
+                index = end
+                continue
+            end = index
+            zeros = 0
+            while end < len(diffs) and zeros < DELTA_MIN_COPY_LENGTH:
+                zeros = zeros + 1 if diffs[end] == 0 else 0
+                end += 1
+            if zeros == DELTA_MIN_COPY_LENGTH:
+                end -= zeros
+            self.data += _header(DELTA_OP_ADD, end - index, source + index)
+            self.data += diffs[index:end]
+            index = end
+
+
+def diff(base: bytes, new: bytes) -> bytes:
+    """Compute the patch producing new from the installed base image."""
+    base = bytes(base)
+    new = bytes(new)
+    index: dict[bytes, list[int]] = {}
+    for source in range(len(base) - DELTA_KEY_LENGTH + 1):
+        candidates = index.setdefault(
+            base[source : source + DELTA_KEY_LENGTH], []
+        )
+        if len(candidates) < DELTA_MAX_CANDIDATES:
+            candidates.append(source)
+
+    patch = _Patch()
+    position = 0
+    while position < len(new):
+        best_length = 0
+        best_source = 0
+        key = new[position : position + DELTA_KEY_LENGTH]
+        for source in index.get(key, []):
+            length = 0
+            while (
+                position + length < len(new)
+                and source + length < len(base)
+                and _is_readable(source + length, position + length)
+                and base[source + length] == new[position + length]
+            ):
+                length += 1
+            if length > best_length:
+                best_length = length
+                best_source = source
+        if best_length < DELTA_KEY_LENGTH:
+            patch.insert(new[position])
+            position += 1
+            continue
+
+        # Extend the match with approximate bytes, as long as most of them
+        # are equal (e.g. code with relocated addresses)
+        end = best_length
+        best_end = end
+        score = 0
+        best_score = 0
+        while (
+            position + end < len(new)
+            and best_source + end < len(base)
+            and _is_readable(best_source + end, position + end)
+            and score > best_score - DELTA_MAX_MISMATCHES
+        ):
+            if base[best_source + end] == new[position + end]:
+                score += 1
+            else:
+                score -= 1
+            end += 1
+            if score > best_score:
+                best_score = score
+                best_end = end
+        patch.aligned(base, new[: position + best_end], best_source, position)
+        position += best_end
+    patch.flush()
+    return bytes(patch.data)
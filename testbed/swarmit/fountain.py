@@ -0,0 +1,43 @@
+"""Fountain coding of broadcast OTA images.
+
+The code matches the bootloader decoder (fountain.c): chunks are grouped in
+generations of FOUNTAIN_GENERATION_SIZE chunks and each symbol is the XOR of
+the chunks of a generation selected by a bit mask of coefficients. A device
+decodes a generation from any symbols whose coefficients are linearly
+independent, so lost symbols don't need to be retransmitted.
+"""
+
+import random
+
+FOUNTAIN_GENERATION_SIZE = 16
+FOUNTAIN_PADDING = 0xFF  # Short chunks are padded with erased flash bytes
+
+
+def generation_count(chunk_count: int) -> int:
+    """Return the number of generations covering chunk_count chunks."""
+    return (
+        chunk_count + FOUNTAIN_GENERATION_SIZE - 1
+    ) // FOUNTAIN_GENERATION_SIZE
+
+
+def symbol_index(generation: int, coefficients: int) -> int:
+    """Return the chunk index field of a symbol."""
+    return (generation << 16) | coefficients
+
+
+def random_coefficients(chunk_count: int) -> int:
+    """Return a random non zero combination of chunk_count chunks."""
+    return random.randint(1, (1 << chunk_count) - 1)
+
+
+def encode(chunks: list[bytes], coefficients: int, symbol_size: int) -> bytes:
+    """Return the symbol combining the chunks selected by coefficients."""
+    symbol = 0
+    for index, chunk in enumerate(chunks):
+        if not coefficients & (1 << index):
+            continue
+        padded = bytes(chunk) + bytes(
+            [FOUNTAIN_PADDING] * (symbol_size - len(chunk))
+        )
+        symbol ^= int.from_bytes(padded, "little")
+    return symbol.to_bytes(symbol_size, "little")
@@ -0,0 +1,156 @@
+"""Decoding of the log events and binary log records of the user images.
+
+Log events are batched in notifications, each entry is prefixed with the
+delta between its timestamp and the one of the previous entry. Entries are
+timestamped by the network core when it reads them from the ring shared with
+the user image, shortly after they were logged.
+
+A binary log record only holds the address of its format string in the user image, a
+count byte and the 32-bit little endian arguments. The format strings are read
+from the allocated sections of the user image ELF file and the arguments are
+formatted on the host, like printf would on the device.
+"""
+
+import re
+import struct
+
+ELF_MAGIC = b"\x7fELF"
+ELF_CLASS_32 = 1
+ELF_DATA_LITTLE_ENDIAN = 1
+ELF_SECTION_TYPE_NOBITS = 8  # Section without content in the file (.bss)
+ELF_SECTION_FLAG_ALLOC = 0x2  # Section loaded in the device memory
+LOG_RECORD_HEADER_SIZE = 5  # Format string address and arguments count
+LOG_FORMAT_SPECIFIER = re.compile(
+    r"%([-+ #0]*)(\d*)(?:\.(\d+))?(?:hh|h|ll|l|z|t)?([diouxXcsp%])"
+)
+
+
+class ElfImage:
+    """Allocated sections of a 32-bit little endian ELF file."""
+
+    def __init__(self, data: bytes):
+        if (
+            data[:4] != ELF_MAGIC
+            or data[4] != ELF_CLASS_32
+            or data[5] != ELF_DATA_LITTLE_ENDIAN
+        ):
+            raise ValueError("Not a 32-bit little endian ELF file")
+        (section_offset,) = struct.unpack_from("<I", data, 0x20)
+        section_size, section_count = struct.unpack_from("<HH", data, 0x2E)
+        self.sections: list[tuple[int, bytes]] = []
+        for index in range(section_count):
+            _, type_, flags, address, offset, size = struct.unpack_from(
+                "<IIIIII", data, section_offset + index * section_size
+            )
+            if (
+                not flags & ELF_SECTION_FLAG_ALLOC
+                or type_ == ELF_SECTION_TYPE_NOBITS
+                or not size
+            ):
+                continue
+            self.sections.append((address, data[offset : offset + size]))
+
+    def read_string(self, address: int):
+        """Return the null terminated string at address, None if not found."""
+        for start, content in self.sections:
+            if not start <= address < start + len(content):
+                continue
+            end = content.find(b"\0", address - start)
+            if end < 0:
+                return None
+            return content[address - start : end].decode(errors="replace")
+        return None
+
+
+def parse_events(timestamp: int, data: bytes) -> list[tuple[int, bytes]]:
+    """Split the data of a notification in (timestamp, logged bytes)."""
+    events = []
+    pos = 0
+    while pos < len(data):
+        delta = 0
+        shift = 0
+        while pos < len(data):
+            byte = data[pos]
+            pos += 1
+            delta |= (byte & 0x7F) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        if pos >= len(data):
+            break
+        length = data[pos]
+        pos += 1
+        if pos + length > len(data):
+            break
+        timestamp = (timestamp + delta) & 0xFFFFFFFF
+        events.append((timestamp, bytes(data[pos : pos + length])))
+        pos += length
+    return events
+
+
+def parse_records(data: bytes) -> list[tuple[int, list[int]]]:
+    """Split the data of a notification in (format address, arguments)."""
+    records = []
+    pos = 0
+    while pos + LOG_RECORD_HEADER_SIZE <= len(data):
+        fmt, count = struct.unpack_from("<IB", data, pos)
+        pos += LOG_RECORD_HEADER_SIZE
+        if pos + count * 4 > len(data):
+            break
+        records.append(
+            (fmt, list(struct.unpack_from(f"<{count}I", data, pos)))
+        )
+        pos += count * 4
+    return records
+
+
+class LogDecoder:
+    """Format the binary log records, using the user image ELF file if any."""
+
+    def __init__(self, elf: bytes = b""):
+        self.image = ElfImage(elf) if elf else None
+
+    def _read_string(self, address: int):
+        if self.image is None:
+            return None
+        return self.image.read_string(address)
+
+    def format(self, fmt: str, args: list[int]) -> str:
+        """Format the arguments like printf, they are 32-bit words."""
+        remaining = iter(args)
+
+        def _convert(match):
+            flags, width, precision, conversion = match.groups()
+            if conversion == "%":
+                return "%"
+            value = next(remaining, 0)
+            if conversion in "di":
+                conversion = "d"
+                if value & 0x80000000:
+                    value -= 1 << 32
+            elif conversion == "u":
+                conversion = "d"
+            elif conversion == "c":
+                value = chr(value & 0xFF)
+            elif conversion == "p":
+                return f"0x{value:08x}"
+            elif conversion == "s":
+                # Only strings stored in the image, like literals, can be resolved
+                string = self._read_string(value)
+                value = f"<0x{value:08x}>" if string is None else string
+            precision = f".{precision}" if precision else ""
+            return f"%{flags}{width}{precision}{conversion}" % value
+
+        return LOG_FORMAT_SPECIFIER.sub(_convert, fmt)
+
+    def decode(self, data: bytes) -> list[str]:
+        """Return the messages of the records held in a notification."""
+        messages = []
+        for fmt_address, args in parse_records(data):
+            fmt = self._read_string(fmt_address)
+            if fmt is None:
+                arguments = " ".join(f"0x{arg:08x}" for arg in args)
+                messages.append(f"<0x{fmt_address:08x}> {arguments}".rstrip())
+                continue
+            messages.append(self.format(fmt, args).rstrip("\n"))
+        return messages
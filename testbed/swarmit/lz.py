@@ -0,0 +1,144 @@
+"""LZ compression of OTA images.
+
+The stream format matches the bootloader decoder (lz.c): LZ4-like sequences
+made of a token byte (literals length in the high nibble, match length minus
+4 in the low nibble, both extended with additional bytes when equal to 15),
+the literals and a 16-bit little endian match offset. Each block only holds
+complete sequences and the last sequence of a block may have no match.
+"""
+
+LZ_WINDOW_SIZE = 2048
+LZ_BLOCK_MAX_SIZE = 1024  # Max decompressed size of a block
+LZ_MIN_MATCH_LENGTH = 4
+LZ_LENGTH_EXTENDED = 15
+LZ_MAX_CANDIDATES = 32  # Max number of previous positions tested per match
+
+
+def _length_size(length: int) -> int:
+    """Return the number of extension bytes needed to encode a length."""
+    if length < LZ_LENGTH_EXTENDED:
+        return 0
+    return (length - LZ_LENGTH_EXTENDED) // 255 + 1
+
+
+def _encode_length(length: int) -> bytes:
+    if length < LZ_LENGTH_EXTENDED:
+        return b""
+    length -= LZ_LENGTH_EXTENDED
+    return b"\xff" * (length // 255) + bytes([length % 255])
+
+
+def _sequence_size(literals: int, match: int) -> int:
+    """Return the encoded size of a sequence, match is 0 without match."""
+    size = 1 + _length_size(literals) + literals
+    if match:
+        size += 2 + _length_size(match - LZ_MIN_MATCH_LENGTH)
+    return size
+
+
+def _encode_sequence(literals: bytes, offset: int, match: int) -> bytes:
+    match_length = match - LZ_MIN_MATCH_LENGTH if match else 0
+    token = (min(len(literals), LZ_LENGTH_EXTENDED) << 4) | min(
+        match_length, LZ_LENGTH_EXTENDED
+    )
+    sequence = bytes([token]) + _encode_length(len(literals)) + literals
+    if match:
+        sequence += offset.to_bytes(2, "little")
+        sequence += _encode_length(match_length)
+    return sequence
+
+
+def _find_sequences(data: bytes) -> list[tuple[bytes, int, int]]:
+    """Greedy LZ77 parsing of data in (literals, offset, match) sequences."""
+    sequences = []
+    positions: dict[bytes, list[int]] = {}
+    literals_start = 0
+    position = 0
+    while position + LZ_MIN_MATCH_LENGTH <= len(data):
+        key = data[position : position + LZ_MIN_MATCH_LENGTH]
+        best_length = 0
+        best_offset = 0
+        candidates = positions.setdefault(key, [])
+        for candidate in reversed(candidates[-LZ_MAX_CANDIDATES:]):
+            offset = position - candidate
+            if offset > LZ_WINDOW_SIZE:
+                break
+            length = LZ_MIN_MATCH_LENGTH
+            while (
+                position + length < len(data)
+                and data[candidate + length] == data[position + length]
+            ):
+                length += 1
+            if length > best_length:
+                best_length = length
+                best_offset = offset
+        candidates.append(position)
+        if best_length < LZ_MIN_MATCH_LENGTH:
+            position += 1
+            continue
+        sequences.append(
+            (data[literals_start:position], best_offset, best_length)
+        )
+        for index in range(position + 1, position + best_length):
+            if index + LZ_MIN_MATCH_LENGTH <= len(data):
+                positions.setdefault(
+                    data[index : index + LZ_MIN_MATCH_LENGTH], []
+                ).append(index)
+        position += best_length
+        literals_start = position
+    if literals_start < len(data):
+        sequences.append((data[literals_start:], 0, 0))
+    return sequences
+
+
+def compress(data: bytes, block_size: int) -> list[bytes]:
+    """Compress data in blocks of at most block_size bytes.
+
+    Blocks must be decompressed in order, a block decompresses to at most
+    LZ_BLOCK_MAX_SIZE bytes.
+    """
+    data = bytes(data)
+    blocks = []
+    block = b""
+    output = 0
+
+    def close_block():
+        nonlocal block, output
+        if block:
+            blocks.append(block)
+        block = b""
+        output = 0
+
+    for literals, offset, match in _find_sequences(data):
+        while literals or match:
+            space = block_size - len(block)
+            output_space = LZ_BLOCK_MAX_SIZE - output
+            if (
+                _sequence_size(len(literals), match) <= space
+                and len(literals) + match <= output_space
+            ):
+                block += _encode_sequence(literals, offset, match)
+                output += len(literals) + match
+                break
+            if literals:
+                # Split the literals, a sequence without match ends the block
+                count = max(0, min(len(literals), output_space, space - 1))
+                while count and _sequence_size(count, 0) > space:
+                    count -= 1
+                if count:
+                    block += _encode_sequence(literals[:count], 0, 0)
+                    literals = literals[count:]
+                close_block()
+                continue
+            # Split the match, both parts keep the same offset
+            count = min(match, output_space)
+            while count and _sequence_size(0, count) > space:
+                count -= 1
+            if match - count and match - count < LZ_MIN_MATCH_LENGTH:
+                count = match - LZ_MIN_MATCH_LENGTH
+            if count >= LZ_MIN_MATCH_LENGTH:
+                block += _encode_sequence(b"", offset, count)
+                match -= count
+            close_block()
+    close_block()
+    return blocks
@@ -2,7 +2,7 @@
 
 import dataclasses
 from dataclasses import dataclass
-from enum import Enum, IntEnum
+from enum import Enum, IntEnum, IntFlag
 
 from dotbot.protocol import Payload, PayloadFieldMetadata, register_parser
 from marilib.mari_protocol import DefaultPayloadType as MariDefaultPayloadType
@@ -27,6 +27,15 @@ class DeviceType(Enum):
     nRF5340DK = 3
 
 
+class OtaMode(IntFlag):
+    """Encodings of the OTA chunks, delta can be combined with LZ."""
+
+    Raw = 0
+    Lz = 1
+    Delta = 2
+    Fountain = 4
+
+
 class SwarmitPayloadType(IntEnum):
     """Types of DotBot payload types."""
 
@@ -37,6 +46,9 @@ class SwarmitPayloadType(IntEnum):
     SWARMIT_REQUEST_RESET = 0x83
     SWARMIT_REQUEST_OTA_START = 0x84
     SWARMIT_REQUEST_OTA_CHUNK = 0x85
+    SWARMIT_REQUEST_OTA_STATUS = 0x86
+    SWARMIT_REQUEST_OTA_PAGE_HASHES = 0x87
+    SWARMIT_REQUEST_STATUS_POLICY = 0x88
 
     # Notifications
     SWARMIT_NOTIFICATION_STATUS = 0x90
@@ -44,6 +56,9 @@ class SwarmitPayloadType(IntEnum):
     SWARMIT_NOTIFICATION_OTA_CHUNK_ACK = 0x94
     SWARMIT_NOTIFICATION_EVENT_GPIO = 0x95
     SWARMIT_NOTIFICATION_EVENT_LOG = 0x96
+    SWARMIT_NOTIFICATION_OTA_CHUNK_BITMAP = 0x97
+    SWARMIT_NOTIFICATION_OTA_PAGE_HASHES = 0x98
+    SWARMIT_NOTIFICATION_LOG_RECORDS = 0x99
 
     # Custom messages
     SWARMIT_MESSAGE = 0xA0
@@ -104,11 +119,27 @@ class PayloadOTAStartRequest(Payload):
             PayloadFieldMetadata(
                 name="fw_chunk_counts", disp="chunks", length=4
             ),
+            PayloadFieldMetadata(name="ack_interval", disp="ack", length=1),
+            PayloadFieldMetadata(name="mode", length=1),
+            PayloadFieldMetadata(name="base_size", disp="base", length=4),
+            PayloadFieldMetadata(name="base_hash", type_=bytes, length=8),
+            PayloadFieldMetadata(name="pages", type_=bytes, length=30),
+            PayloadFieldMetadata(name="chunk_size", disp="chunk", length=1),
+            PayloadFieldMetadata(name="image_hash", type_=bytes, length=8),
+            PayloadFieldMetadata(name="stage", length=1),
         ]
     )
 
     fw_length: int = 0
     fw_chunk_count: int = 0
+    ack_interval: int = 0
+    mode: int = OtaMode.Raw.value
+    base_size: int = 0
+    base_hash: bytes = dataclasses.field(default_factory=lambda: bytes(8))
+    pages: bytes = dataclasses.field(default_factory=lambda: bytes(30))
+    chunk_size: int = 0
+    image_hash: bytes = dataclasses.field(default_factory=lambda: bytes(8))
+    stage: int = 0  # Running devices ignore the request when not set
 
 
 @dataclass
@@ -130,12 +161,61 @@ class PayloadOTAChunkRequest(Payload):
     chunk: bytes = dataclasses.field(default_factory=lambda: bytearray)
 
 
+@dataclass
+class PayloadOTAStatusRequest(PayloadRequest):
+    """Dataclass that holds an OTA status request packet."""
+
+
+@dataclass
+class PayloadOTAPageHashesRequest(Payload):
+    """Dataclass that holds an OTA page hashes request packet."""
+
+    metadata: list[PayloadFieldMetadata] = dataclasses.field(
+        default_factory=lambda: [
+            PayloadFieldMetadata(name="first_page", disp="first"),
+            PayloadFieldMetadata(name="page_count", disp="pages"),
+            PayloadFieldMetadata(name="size", length=4),
+        ]
+    )
+
+    first_page: int = 0
+    page_count: int = 0
+    size: int = 0
+
+
+@dataclass
+class PayloadStatusPolicyRequest(Payload):
+    """Dataclass that holds a status policy request packet.
+
+    Devices send their status when it changes, when their battery level
+    changes by `battery_delta` mV or their position by `position_delta` on
+    one axis (0 disables these checks), and at least every `heartbeat` ms.
+    """
+
+    metadata: list[PayloadFieldMetadata] = dataclasses.field(
+        default_factory=lambda: [
+            PayloadFieldMetadata(name="heartbeat", disp="hb", length=4),
+            PayloadFieldMetadata(name="battery_delta", disp="bat.", length=2),
+            PayloadFieldMetadata(name="position_delta", disp="pos.", length=4),
+        ]
+    )
+
+    heartbeat: int = 0
+    battery_delta: int = 0
+    position_delta: int = 0
+
+
 # Notifications
 
 
 @dataclass
 class PayloadStatusNotification(Payload):
-    """Dataclass that holds an application status notification packet."""
+    """Dataclass that holds an application status notification packet.
+
+    `image_hash` holds the truncated SHA256 of the installed user image, zeros
+    when unknown. `rx_dropped` counts the received packets the device dropped
+    because its queues were full.
+    """
 
     metadata: list[PayloadFieldMetadata] = dataclasses.field(
         default_factory=lambda: [
@@ -148,6 +228,10 @@ class PayloadStatusNotification(Payload):
             PayloadFieldMetadata(
                 name="pos_y", disp="pos y", length=4, signed=True
             ),
+            PayloadFieldMetadata(
+                name="image_hash", disp="image", type_=bytes, length=8
+            ),
+            PayloadFieldMetadata(name="rx_dropped", disp="drops", length=4),
         ]
     )
 
@@ -156,6 +240,8 @@ class PayloadStatusNotification(Payload):
     battery: int = 0
     pos_x: int = 0
     pos_y: int = 0
+    image_hash: bytes = dataclasses.field(default_factory=lambda: bytes(8))
+    rx_dropped: int = 0
 
 
 @dataclass
@@ -163,9 +249,13 @@ class PayloadOTAStartAckNotification(Payload):
     """Dataclass that holds an application OTA start ACK notification packet."""
 
     metadata: list[PayloadFieldMetadata] = dataclasses.field(
-        default_factory=lambda: []
+        default_factory=lambda: [
+            PayloadFieldMetadata(name="chunk_size_max", disp="max", length=1),
+        ]
     )
 
+    chunk_size_max: int = 0
+
 
 @dataclass
 class PayloadOTAChunkAckNotification(Payload):
@@ -180,6 +270,52 @@ class PayloadOTAChunkAckNotification(Payload):
     index: int = 0
 
 
+@dataclass
+class PayloadOTAChunkBitmapNotification(Payload):
+    """Dataclass that holds an OTA chunk bitmap notification packet.
+
+    All chunks below `base` are received, bit i of `bitmap` is set when
+    chunk `base + i` is received.
+    """
+
+    metadata: list[PayloadFieldMetadata] = dataclasses.field(
+        default_factory=lambda: [
+            PayloadFieldMetadata(name="base", length=4),
+            PayloadFieldMetadata(name="count", disp="len."),
+            PayloadFieldMetadata(
+                name="bitmap", disp="bitmap", type_=bytes, length=0
+            ),
+        ]
+    )
+
+    base: int = 0
+    count: int = 0
+    bitmap: bytes = dataclasses.field(default_factory=lambda: bytearray)
+
+
+@dataclass
+class PayloadOTAPageHashesNotification(Payload):
+    """Dataclass that holds an OTA page hashes notification packet.
+
+    `hashes` holds the truncated SHA256 of each page, starting from
+    `first_page`.
+    """
+
+    metadata: list[PayloadFieldMetadata] = dataclasses.field(
+        default_factory=lambda: [
+            PayloadFieldMetadata(name="first_page", disp="first"),
+            PayloadFieldMetadata(name="count", disp="len."),
+            PayloadFieldMetadata(
+                name="hashes", disp="hashes", type_=bytes, length=0
+            ),
+        ]
+    )
+
+    first_page: int = 0
+    count: int = 0
+    hashes: bytes = dataclasses.field(default_factory=lambda: bytearray)
+
+
 @dataclass
 class PayloadEventNotification(Payload):
     """Dataclass that holds an event notification packet."""
@@ -199,6 +335,54 @@ class PayloadEventNotification(Payload):
     data: bytes = dataclasses.field(default_factory=lambda: bytearray)
 
 
+@dataclass
+class PayloadLogEventsNotification(Payload):
+    """Dataclass that holds a log events notification packet.
+
+    Each entry of `data` is made of the delta in microseconds between its
+    timestamp and the one of the previous entry (LEB128 varint, the first
+    entry is at `timestamp`), its length (1 byte) and the logged bytes.
+    """
+
+    metadata: list[PayloadFieldMetadata] = dataclasses.field(
+        default_factory=lambda: [
+            PayloadFieldMetadata(name="timestamp", disp="ts", length=4),
+            PayloadFieldMetadata(name="count", disp="len."),
+            PayloadFieldMetadata(
+                name="data", disp="data", type_=bytes, length=0
+            ),
+        ]
+    )
+
+    timestamp: int = 0
+    count: int = 0
+    data: bytes = dataclasses.field(default_factory=lambda: bytearray)
+
+
+@dataclass
+class PayloadLogRecordsNotification(Payload):
+    """Dataclass that holds a binary log records notification packet.
+
+    Each record of `data` is made of the address of its format string in the
+    user image (4 bytes), the number of arguments (1 byte) and the 32-bit
+    arguments.
+    """
+
+    metadata: list[PayloadFieldMetadata] = dataclasses.field(
+        default_factory=lambda: [
+            PayloadFieldMetadata(name="timestamp", disp="ts", length=4),
+            PayloadFieldMetadata(name="count", disp="len."),
+            PayloadFieldMetadata(
+                name="data", disp="data", type_=bytes, length=0
+            ),
+        ]
+    )
+
+    timestamp: int = 0
+    count: int = 0
+    data: bytes = dataclasses.field(default_factory=lambda: bytearray)
+
+
 @dataclass
 class PayloadMessage(Payload):
     """Dataclass that holds a message packet."""
@@ -247,6 +431,17 @@ def register_parsers():
     register_parser(
         SwarmitPayloadType.SWARMIT_REQUEST_OTA_CHUNK, PayloadOTAChunkRequest
     )
+    register_parser(
+        SwarmitPayloadType.SWARMIT_REQUEST_OTA_STATUS, PayloadOTAStatusRequest
+    )
+    register_parser(
+        SwarmitPayloadType.SWARMIT_REQUEST_OTA_PAGE_HASHES,
+        PayloadOTAPageHashesRequest,
+    )
+    register_parser(
+        SwarmitPayloadType.SWARMIT_REQUEST_STATUS_POLICY,
+        PayloadStatusPolicyRequest,
+    )
     register_parser(
         SwarmitPayloadType.SWARMIT_NOTIFICATION_STATUS,
         PayloadStatusNotification,
@@ -260,8 +455,24 @@ def register_parsers():
         PayloadOTAChunkAckNotification,
     )
     register_parser(
-        SwarmitPayloadType.SWARMIT_NOTIFICATION_EVENT_LOG,
+        SwarmitPayloadType.SWARMIT_NOTIFICATION_OTA_CHUNK_BITMAP,
+        PayloadOTAChunkBitmapNotification,
+    )
+    register_parser(
+        SwarmitPayloadType.SWARMIT_NOTIFICATION_OTA_PAGE_HASHES,
+        PayloadOTAPageHashesNotification,
+    )
+    register_parser(
+        SwarmitPayloadType.SWARMIT_NOTIFICATION_EVENT_GPIO,
         PayloadEventNotification,
     )
+    register_parser(
+        SwarmitPayloadType.SWARMIT_NOTIFICATION_EVENT_LOG,
+        PayloadLogEventsNotification,
+    )
+    register_parser(
+        SwarmitPayloadType.SWARMIT_NOTIFICATION_LOG_RECORDS,
+        PayloadLogRecordsNotification,
+    )
     register_parser(SwarmitPayloadType.SWARMIT_MESSAGE, PayloadMessage)
     register_parser(SwarmitPayloadType.METRICS_PROBE, MetricsProbePayload)